@@ -0,0 +1,9 @@
+.text
+movz x2, 1
+movz x3, 2
+ands x1, x2, x3
+b.eq skip
+movz x4, 1
+skip:
+movz x5, 1
+hlt 0
@@ -0,0 +1,7 @@
+d2800022 
+d2800043 
+ea030041 
+54000040 
+d2800024 
+d2800025 
+d4400000 
\ No newline at end of file
@@ -0,0 +1,6 @@
+.text
+movz x5, 0x1000, lsl 16
+ldur x1, [x5, 0x0]
+add x2, x2, 1
+add x3, x1, 0
+hlt 0
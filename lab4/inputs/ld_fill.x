@@ -0,0 +1,5 @@
+d2a20005 
+f84000a1 
+91000442 
+91000023 
+d4400000 
\ No newline at end of file
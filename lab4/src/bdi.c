@@ -0,0 +1,78 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "bdi.h"
+
+/* base and delta widths in bytes, tried in this order */
+static const int bdi_encodings[][2] = {
+    { 8, 1 }, { 8, 2 }, { 8, 4 }, { 4, 1 }, { 4, 2 }, { 2, 1 },
+};
+
+// Little-endian word of bytes bytes, as an unsigned value
+static uint64_t bdi_word(const uint8_t *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// Whether v, taken as a bits-wide two's complement number, fits in a
+// signed delta of delta bytes
+static int bdi_fits(uint64_t v, int bits, int delta)
+{
+    if (bits < 64) {
+        uint64_t sign = 1ULL << (bits - 1);
+        v = ((v & ((sign << 1) - 1)) ^ sign) - sign;
+    }
+    int64_t d = (int64_t) v;
+    int64_t limit = 1LL << (delta * 8 - 1);
+    return d >= -limit && d < limit;
+}
+
+// Whether every base-byte word of the block is a delta-byte delta from
+// zero or from the first word that is not
+static int bdi_try(const uint8_t *block, int size, int base, int delta)
+{
+    int have_base = 0;
+    uint64_t b = 0;
+    for (int i = 0; i < size; i += base) {
+        uint64_t v = bdi_word(block + i, base);
+        if (bdi_fits(v, base * 8, delta)) continue;
+        if (!have_base) {
+            b = v;
+            have_base = 1;
+        }
+        if (!bdi_fits(v - b, base * 8, delta)) return 0;
+    }
+    return 1;
+}
+
+// Bytes the block takes under the best encoding that fits it; the bit per
+// word saying which base a delta is from is kept with the tag
+int bdi_compressed_size(const uint8_t *block, int size)
+{
+    int zero = 1, repeated = size % 8 == 0;
+    for (int i = 0; i < size && (zero || repeated); i++) {
+        zero &= block[i] == 0;
+        repeated &= i < 8 || block[i] == block[i - 8];
+    }
+    if (zero) return 1;
+    if (repeated) return 8;
+
+    int best = size;
+    for (int e = 0; e < (int) (sizeof(bdi_encodings) / sizeof(bdi_encodings[0])); e++) {
+        int base = bdi_encodings[e][0], delta = bdi_encodings[e][1];
+        if (size % base) continue;
+        int bytes = base + size / base * delta;
+        if (bytes < best && bdi_try(block, size, base, delta)) {
+            best = bytes;
+        }
+    }
+    return best;
+}
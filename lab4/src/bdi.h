@@ -0,0 +1,20 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Base-delta-immediate (BDI) compression of cache blocks. A block is
+ * stored as one base word plus a narrow delta per word, where each delta
+ * is taken either from the base or from zero (the immediate), so blocks
+ * of nearby pointers mixed with small integers still compress. All-zero
+ * blocks and blocks of one repeated 8-byte value have encodings of their
+ * own; a block no encoding fits stays uncompressed.
+ */
+#ifndef _BDI_H_
+#define _BDI_H_
+
+#include <stdint.h>
+
+int bdi_compressed_size(const uint8_t *block, int size);
+
+#endif
@@ -13,7 +13,7 @@
 #include "pipe.h"
 #include <string.h>
 
-bp_t bp;
+CORE_LOCAL bp_t bp;
 
 static uint32_t bp_extract_bits(uint64_t instruction, int start, int end){
     /* Given an instruction type, returns a section from start: end (inclusive)*/
@@ -39,6 +39,54 @@ void bp_t_init()
 
 }
 
+/* Deep copy of predictor state. Tables in dst are allocated on first use,
+ * so a zeroed bp_t can be passed to take a private copy. */
+void bp_copy(bp_t *dst, const bp_t *src)
+{
+    int pht_size = 1 << src->ghr_bits;
+
+    if (!dst->pht) {
+        dst->pht = (uint8_t*)calloc(pht_size, sizeof(uint8_t));
+        dst->btb_tag = (uint64_t*)calloc(src->btb_size, sizeof(uint64_t));
+        dst->btb_dest = (uint64_t*)calloc(src->btb_size, sizeof(uint64_t));
+        dst->btb_valid = (uint8_t*)calloc(src->btb_size, sizeof(uint8_t));
+        dst->btb_cond = (uint8_t*)calloc(src->btb_size, sizeof(uint8_t));
+    }
+    dst->ghr_bits = src->ghr_bits;
+    dst->ghr = src->ghr;
+    dst->btb_size = src->btb_size;
+    dst->btb_bits = src->btb_bits;
+    dst->space = src->space;
+    dst->stat_cross_evictions = src->stat_cross_evictions;
+
+    memcpy(dst->pht, src->pht, pht_size * sizeof(uint8_t));
+    memcpy(dst->btb_tag, src->btb_tag, src->btb_size * sizeof(uint64_t));
+    memcpy(dst->btb_dest, src->btb_dest, src->btb_size * sizeof(uint64_t));
+    memcpy(dst->btb_valid, src->btb_valid, src->btb_size * sizeof(uint8_t));
+    memcpy(dst->btb_cond, src->btb_cond, src->btb_size * sizeof(uint8_t));
+}
+
+void bp_free(bp_t *b)
+{
+    free(b->pht);
+    free(b->btb_tag);
+    free(b->btb_dest);
+    free(b->btb_valid);
+    free(b->btb_cond);
+    memset(b, 0, sizeof(bp_t));
+}
+
+// Invalidate the whole BTB; returns the number of entries dropped
+int bp_flush_btb(void)
+{
+    int flushed = 0;
+    for (int i = 0; i < bp.btb_size; i++) {
+        flushed += bp.btb_valid[i];
+        bp.btb_valid[i] = 0;
+    }
+    return flushed;
+}
+
 // void bp_predict(struct Pipe_Op *op)
 // {
 //     uint64_t pc = op -> PC;
@@ -63,6 +111,7 @@ void bp_t_init()
 void bp_predict(struct Pipe_Op *op)
 {
     uint64_t pc = op->PC;
+    uint64_t tag = pc | bp.space;
     uint32_t ghr_mask = (1u << bp.ghr_bits) - 1;
     unsigned int pht_index = (bp_extract_bits(pc, 2, 9) ^ bp.ghr) & ghr_mask;
     op->GHR_XOR_PC = pht_index;
@@ -72,7 +121,7 @@ void bp_predict(struct Pipe_Op *op)
     // printf("BP_PREDICT: PC=0x%lx, GHR=0x%x, PHT_idx=%d, counter=%d, BTB_idx=%d\n", 
     //        pc, bp.ghr, pht_index, counter, btb_index);
     
-    if (bp.btb_valid[btb_index] && (bp.btb_tag[btb_index] == pc)) {
+    if (bp.btb_valid[btb_index] && (bp.btb_tag[btb_index] == tag)) {
         op->BTB_MISS = 0;
         // printf("BTB_HIT: tag=0x%lx, dest=0x%lx, cond=%d\n", 
         //        bp.btb_tag[btb_index], bp.btb_dest[btb_index], bp.btb_cond[btb_index]);
@@ -128,18 +177,22 @@ void bp_update(struct Pipe_Op *op)
     unsigned int btb_index = bp_extract_bits(op->PC, 2, 11);
     // printf("BTB_UPDATE: idx=%d, PC=0x%lx, target=0x%lx, cond=%d\n",
     //        btb_index, op->PC, op->BR_TARGET, op->CBRANCH ? 1 : 0);
+    uint64_t tag = op->PC | bp.space;
     if (bp.btb_valid[btb_index]) {
-        if (bp.btb_tag[btb_index] == op -> PC) {
+        if (bp.btb_tag[btb_index] == tag) {
             bp.btb_dest[btb_index] = op -> BR_TARGET;
             bp.btb_cond[btb_index] = op -> CBRANCH ? 1 : 0;
         } else {
-            bp.btb_tag[btb_index] = op -> PC;
+            if ((bp.btb_tag[btb_index] ^ tag) >> CACHE_SPACE_SHIFT) {
+                bp.stat_cross_evictions++;
+            }
+            bp.btb_tag[btb_index] = tag;
             bp.btb_dest[btb_index] = op -> BR_TARGET;
             bp.btb_valid[btb_index] = 1;
             bp.btb_cond[btb_index] = op -> CBRANCH ? 1 : 0;
         }
     } else {
-        bp.btb_tag[btb_index] = op -> PC;
+        bp.btb_tag[btb_index] = tag;
         bp.btb_dest[btb_index] = op -> BR_TARGET;
         bp.btb_valid[btb_index] = 1;
         bp.btb_cond[btb_index] = op -> CBRANCH ? 1 : 0;
@@ -11,6 +11,7 @@
 #define _BP_H_
 
 #include <stdint.h>
+#include "shell.h"
 
 struct Pipe_Op;
 
@@ -28,10 +29,19 @@ typedef struct
     uint64_t *btb_dest;
     uint8_t *btb_valid;
     uint8_t *btb_cond;
+
+    /* address space of the running process, part of every BTB tag */
+    uint64_t space;
+
+    /* statistics */
+    uint64_t stat_cross_evictions; /* BTB entries of another address space replaced */
 } bp_t;
-extern bp_t bp;
+extern CORE_LOCAL bp_t bp;
 
 void bp_t_init();
+void bp_copy(bp_t *dst, const bp_t *src);
+void bp_free(bp_t *b);
+int bp_flush_btb(void);
 
 void bp_predict(struct Pipe_Op *op);
 // In fetch:
@@ -8,7 +8,11 @@
 #include "cache.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
+#include <string.h>
+#include <inttypes.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
 
 
 // cache_t *cache_new(int sets, int ways, int block)
@@ -52,208 +56,1187 @@
 //     return cache;
 // }
 
+// log2 of a power of two, or -1 if n is not one (avoids linking libm)
+static int cache_log2(int n)
+{
+    if (n <= 0 || (n & (n - 1)) != 0) return -1;
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+    return bits;
+}
+
 cache_t *cache_new(int sets, int ways, int block)
 {
-    cache_t *cache = (cache_t *) malloc(sizeof(cache_t));
-    if (!cache) {
-        fprintf(stderr, "Failed to allocate memory for cache\n");
+    // Validate geometry before allocating anything
+    int set_index_bits = cache_log2(sets);
+    int block_offset_bits = cache_log2(block);
+    if (set_index_bits < 0) {
+        fprintf(stderr, "Unsupported number of sets: %d (must be a power of two)\n", sets);
+        exit(1);
+    }
+    if (block_offset_bits < 2) {
+        fprintf(stderr, "Unsupported block size: %d (must be a power of two >= 4)\n", block);
+        exit(1);
+    }
+    if (ways < 1) {
+        fprintf(stderr, "Unsupported number of ways: %d\n", ways);
+        exit(1);
+    }
+    if (set_index_bits + block_offset_bits >= 64) {
+        fprintf(stderr, "Cache geometry too large: %d sets of %d-byte blocks\n", sets, block);
         exit(1);
     }
 
-    // Allocate the sets array first
-    cache->sets = (cache_set_t *) malloc(sets * sizeof(cache_set_t));
-    if (!cache->sets) {
-        fprintf(stderr, "Failed to allocate memory for cache sets\n");
-        free(cache);
+    cache_t *cache = (cache_t *) calloc(1, sizeof(cache_t));
+    if (!cache) {
+        fprintf(stderr, "Failed to allocate memory for cache\n");
         exit(1);
     }
+    cache->name = "cache";
 
     // Initialize cache parameters
     cache->num_sets = sets;
     cache->num_ways = ways; 
     cache->block_size = block;
 
-    // Calculate bit fields without using log2 to avoid linker issues
-    cache->block_offset_bits = 5;  // log2(32) = 5 for 32-byte blocks
-    if (sets == 64) {
-        cache->set_index_bits = 6;  // log2(64) = 6
-    } else if (sets == 256) {
-        cache->set_index_bits = 8;  // log2(256) = 8  
-    } else {
-        fprintf(stderr, "Unsupported number of sets: %d\n", sets);
+    // Derive index and tag fields from the geometry
+    cache->block_offset_bits = block_offset_bits;
+    cache->set_index_bits = set_index_bits;
+    cache->tag_bits = 64 - cache->set_index_bits - cache->block_offset_bits;
+    cache->tag_shift = set_index_bits;
+    cache->index_prime = sets;
+    cache->sectors = 1;
+    cache->sector_size = block;
+    cache->sector_offset_bits = block_offset_bits;
+
+    // One aligned block holds every tag; all entries start invalid (0)
+    cache->way_stride = (ways + CACHE_WAY_ALIGN - 1) / CACHE_WAY_ALIGN * CACHE_WAY_ALIGN;
+    size_t tag_bytes = (size_t) sets * cache->way_stride * sizeof(uint64_t);
+    void *tags = NULL;
+    if (posix_memalign(&tags, 64, tag_bytes) != 0) {
+        fprintf(stderr, "Failed to allocate memory for cache tags\n");
+        free(cache);
         exit(1);
     }
-    cache->tag_bits = 64 - cache->set_index_bits - cache->block_offset_bits;
+    memset(tags, 0, tag_bytes);
+    cache->tags = (uint64_t *) tags;
 
-    // Allocate cache lines for each set
-    for (int i = 0; i < sets; i++) {
-        cache->sets[i].lines = (cache_line_t *) malloc(ways * sizeof(cache_line_t));
-        if (!cache->sets[i].lines) {
-            fprintf(stderr, "Failed to allocate memory for cache lines in set %d\n", i);
-            // Clean up previously allocated sets
-            for (int k = 0; k < i; k++) {
-                free(cache->sets[k].lines);
-            }
-            free(cache->sets);
-            free(cache);
-            exit(1);
+    cache->dirty = (uint8_t *) calloc((size_t) sets * cache->way_stride, sizeof(uint8_t));
+    cache->prefetched = (uint8_t *) calloc((size_t) sets * cache->way_stride, sizeof(uint8_t));
+    if (!cache->dirty || !cache->prefetched) {
+        fprintf(stderr, "Failed to allocate memory for cache line flags\n");
+        free(cache->dirty);
+        free(cache->prefetched);
+        free(tags);
+        free(cache);
+        exit(1);
+    }
+
+    cache->rng = 0x9E3779B97F4A7C15ULL;
+    cache_set_policy(cache, REPL_LRU);
+
+    return cache;
+}
+
+// Switch replacement policy; policy state for every set starts over
+void cache_set_policy(cache_t *c, repl_policy_t policy)
+{
+    const repl_ops_t *ops = repl_get_ops(policy);
+    if (!ops || (c->index_fn == CACHE_INDEX_SKEW && policy != REPL_LRU)) {
+        fprintf(stderr, "Unsupported replacement policy: %d%s\n", (int) policy,
+                ops ? " (a skewed cache replaces by LRU)" : "");
+        exit(1);
+    }
+
+    int words = repl_words(ops, c->num_ways);
+    uint64_t *meta = (uint64_t *) calloc((size_t) c->num_sets * words, sizeof(uint64_t));
+    if (!meta) {
+        fprintf(stderr, "Failed to allocate replacement state for %s\n", c->name);
+        exit(1);
+    }
+    for (int i = 0; i < c->num_sets; i++) {
+        ops->init(meta + (size_t) i * words, c->num_ways);
+    }
+
+    free(c->repl_meta);
+    c->policy = policy;
+    c->repl = ops;
+    c->repl_meta = meta;
+    c->repl_words = words;
+}
+
+// Attach a prefetcher (PF_NONE removes it); training starts from scratch
+void cache_set_prefetcher(cache_t *c, prefetch_policy_t policy, int degree, int distance)
+{
+    free(c->pf);
+    c->pf = policy == PF_NONE ? NULL : prefetch_new(policy, degree, distance);
+}
+
+// Start (or stop) classifying misses; the shadow cache starts out empty
+void cache_set_classify(cache_t *c, int on)
+{
+    mclass_destroy(c->mclass);
+    c->mclass = on ? mclass_new(c->num_sets, c->num_ways, c->block_size) : NULL;
+}
+
+// Split every line into sectors that are filled, and valid, one at a time
+// under a single tag (1 = whole-line fills). Lines already present count
+// as fully valid.
+void cache_set_sectors(cache_t *c, int sectors)
+{
+    int bits = cache_log2(sectors);
+    if (bits < 0 || sectors > 64 || c->block_size / sectors < 4 || (c->comp_size && sectors > 1)) {
+        fprintf(stderr, "Unsupported sectoring of %s: %d sectors of a %d-byte block\n",
+                c->name, sectors, c->block_size);
+        exit(1);
+    }
+    free(c->sector_valid);
+    free(c->stat_sector_fills);
+    c->sector_valid = NULL;
+    c->stat_sector_fills = NULL;
+    c->sectors = sectors;
+    c->sector_size = c->block_size / sectors;
+    c->sector_offset_bits = c->block_offset_bits - bits;
+    if (sectors == 1) return;
+
+    size_t lines = (size_t) c->num_sets * c->way_stride;
+    c->sector_valid = (uint64_t *) malloc(lines * sizeof(uint64_t));
+    c->stat_sector_fills = (uint64_t *) calloc((size_t) sectors, sizeof(uint64_t));
+    if (!c->sector_valid || !c->stat_sector_fills) {
+        fprintf(stderr, "Failed to allocate sector state for %s\n", c->name);
+        exit(1);
+    }
+    for (size_t i = 0; i < lines; i++) {
+        c->sector_valid[i] = ~0ULL >> (64 - sectors);
+    }
+}
+
+// Read the MRU way of a set first. A hit there takes one cycle; any other
+// lookup reads the rest of the set after it, one cycle later than a plain
+// lookup would finish.
+void cache_set_way_predict(cache_t *c, int on)
+{
+    free(c->way_pred);
+    c->way_pred = NULL;
+    if (!on) return;
+    if (c->num_ways > 65536 || c->index_fn == CACHE_INDEX_SKEW) {
+        fprintf(stderr, "Unsupported way prediction for %s: %d ways%s\n", c->name, c->num_ways,
+                c->index_fn == CACHE_INDEX_SKEW ? ", skewed" : "");
+        exit(1);
+    }
+    c->way_pred = (uint16_t *) calloc((size_t) c->num_sets, sizeof(uint16_t));
+    if (!c->way_pred) {
+        fprintf(stderr, "Failed to allocate way predictor for %s\n", c->name);
+        exit(1);
+    }
+}
+
+// Let the num_ways tags of each set share data_ways blocks of data, each
+// line taking the bytes compress() reports, given the block's aligned
+// address, when it is filled. A hit on a line that is smaller than a block pays
+// decompress_latency more.
+void cache_set_compression(cache_t *c, int data_ways, int decompress_latency,
+                           int (*compress)(uint64_t addr, int block_size))
+{
+    if (data_ways < 1 || data_ways > c->num_ways || c->sectors > 1 || c->block_size > 65536 ||
+        c->index_fn == CACHE_INDEX_SKEW) {
+        fprintf(stderr, "Unsupported compression of %s: %d tags sharing %d blocks of %d bytes%s\n",
+                c->name, c->num_ways, data_ways, c->block_size,
+                c->sectors > 1 ? " in sectors" : c->index_fn == CACHE_INDEX_SKEW ? ", skewed" : "");
+        exit(1);
+    }
+    free(c->comp_size);
+    c->comp_size = (uint16_t *) calloc((size_t) c->num_sets * c->way_stride, sizeof(uint16_t));
+    if (!c->comp_size) {
+        fprintf(stderr, "Failed to allocate compression state for %s\n", c->name);
+        exit(1);
+    }
+    c->compress = compress;
+    c->data_ways = data_ways;
+    c->decompress_latency = decompress_latency;
+}
+
+// Choose how blocks map to sets, while the cache is still empty. A skewed
+// cache needs the whole set to pick a victim, so it cannot also predict
+// ways or compress, and it always replaces by LRU.
+void cache_set_index_fn(cache_t *c, cache_index_t fn)
+{
+    if (fn < CACHE_INDEX_MODULO || fn > CACHE_INDEX_SKEW ||
+        (fn == CACHE_INDEX_SKEW && (c->way_pred || c->comp_size || c->policy != REPL_LRU))) {
+        fprintf(stderr, "Unsupported set index function %d for %s%s\n", (int) fn, c->name,
+                c->way_pred ? " with way prediction" : c->comp_size ? " with compression"
+                : c->policy != REPL_LRU ? " with a policy other than LRU" : "");
+        exit(1);
+    }
+    c->index_fn = fn;
+    c->tag_shift = fn == CACHE_INDEX_MODULO ? c->set_index_bits : 0;
+    c->tag_bits = 64 - c->tag_shift - c->block_offset_bits;
+
+    // Largest prime that is at most the number of sets (1 for one set)
+    c->index_prime = c->num_sets;
+    for (int p = c->num_sets; p > 1; p--) {
+        int d = 2;
+        while (d * d <= p && p % d) d++;
+        if (d * d > p) {
+            c->index_prime = p;
+            break;
         }
+    }
+
+    free(c->line_stamp);
+    c->line_stamp = NULL;
+    c->stamp_clock = 0;
+    if (fn != CACHE_INDEX_SKEW) return;
+    c->line_stamp = (uint64_t *) calloc((size_t) c->num_sets * c->way_stride, sizeof(uint64_t));
+    if (!c->line_stamp) {
+        fprintf(stderr, "Failed to allocate line ages for %s\n", c->name);
+        exit(1);
+    }
+}
+
+static inline int cache_sector(const cache_t *c, uint64_t addr)
+{
+    return (int) ((addr >> c->sector_offset_bits) & (uint64_t) (c->sectors - 1));
+}
 
-        // Initialize each cache line in this set
-        for (int j = 0; j < ways; j++) {
-            cache->sets[i].lines[j].valid = 0;
-            cache->sets[i].lines[j].tag = 0;
-            cache->sets[i].lines[j].lru = 0;
+// Whether addr's sector of the line at index is valid; always for
+// whole-line fills
+static inline int cache_sector_valid(const cache_t *c, int line, uint64_t addr)
+{
+    return !c->sector_valid || ((c->sector_valid[line] >> cache_sector(c, addr)) & 1);
+}
+
+static inline uint64_t *cache_set_meta(const cache_t *c, uint64_t set_index)
+{
+    return c->repl_meta + set_index * c->repl_words;
+}
+
+static inline uint64_t *cache_set_tags(const cache_t *c, uint64_t set_index)
+{
+    return c->tags + set_index * c->way_stride;
+}
+
+static inline uint64_t cache_tag_entry(uint64_t tag)
+{
+    return (tag << 1) | 1;
+}
+
+// First way in a set whose entry equals key, or -1. Compares 8 ways per
+// step with AVX2 (or SSE4.1); stride is always a multiple of 8.
+static inline int cache_match(const uint64_t *set_tags, int stride, uint64_t key)
+{
+#if defined(__AVX2__)
+    __m256i k = _mm256_set1_epi64x((long long) key);
+    for (int i = 0; i < stride; i += 8) {
+        __m256i lo = _mm256_load_si256((const __m256i *) (set_tags + i));
+        __m256i hi = _mm256_load_si256((const __m256i *) (set_tags + i + 4));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, k)))
+                 | (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, k))) << 4);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return -1;
+#elif defined(__SSE4_1__)
+    __m128i k = _mm_set1_epi64x((long long) key);
+    for (int i = 0; i < stride; i += 8) {
+        int mask = 0;
+        for (int j = 0; j < 8; j += 2) {
+            __m128i v = _mm_load_si128((const __m128i *) (set_tags + i + j));
+            mask |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, k))) << j;
+        }
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return -1;
+#else
+    for (int i = 0; i < stride; i += 8) {
+        unsigned mask = 0;
+        for (int j = 0; j < 8; j++) {
+            mask |= (unsigned) (set_tags[i + j] == key) << j;
         }
+        if (mask) return i + __builtin_ctz(mask);
     }
+    return -1;
+#endif
+}
 
-    return cache;
+// XOR of the bits-wide slices of x
+static inline uint64_t cache_fold(uint64_t x, int bits)
+{
+    if (bits == 0) return 0;
+    uint64_t mask = (1ULL << bits) - 1, h = 0;
+    for (; x; x >>= bits) {
+        h ^= x & mask;
+    }
+    return h;
 }
 
+// Set that block number block maps to in way (which matters only when
+// skewed)
+static inline uint64_t cache_set_of(const cache_t *c, uint64_t block, int way)
+{
+    uint64_t mask = (1ULL << c->set_index_bits) - 1;
+    if (c->index_fn == CACHE_INDEX_MODULO) {
+        return block & mask;
+    }
+    if (c->index_fn == CACHE_INDEX_XOR) {
+        return cache_fold(block, c->set_index_bits);
+    }
+    if (c->index_fn == CACHE_INDEX_PRIME) {
+        return block % (uint64_t) c->index_prime;
+    }
+    // Skewed: way 0 is the XOR fold; the others scramble the high bits
+    // with an odd multiplier of their own first, so blocks that collide in
+    // one way seldom collide in the next
+    uint64_t mult = 1 + 2 * (uint64_t) way * 0x9E3779B97F4A7C15ULL;
+    return (block & mask) ^ cache_fold((block >> c->set_index_bits) * mult, c->set_index_bits);
+}
 
-void cache_destroy(cache_t *c)
+// Address of the block whose tag entry sits in set
+static inline uint64_t cache_block_addr(const cache_t *c, uint64_t entry, uint64_t set)
 {
-    if (!c) return;
-    for (int i = 0; i < c->num_sets; i++) {
-        if (c->sets[i].lines) {
-            free(c->sets[i].lines);
+    uint64_t block = entry >> 1;
+    if (c->tag_shift) {
+        block = (block << c->tag_shift) | set;
+    }
+    return block << c->block_offset_bits;
+}
+
+// Way holding addr's line, or -1; *set gets the line's set (on a miss,
+// the set the block maps to in way 0)
+static inline int cache_find(const cache_t *c, uint64_t addr, uint64_t *set)
+{
+    uint64_t block = addr >> c->block_offset_bits;
+    uint64_t key = cache_tag_entry(block >> c->tag_shift);
+    *set = cache_set_of(c, block, 0);
+    if (c->index_fn != CACHE_INDEX_SKEW) {
+        return cache_match(cache_set_tags(c, *set), c->way_stride, key);
+    }
+    for (int way = 0; way < c->num_ways; way++) {
+        uint64_t s = cache_set_of(c, block, way);
+        if (c->tags[s * c->way_stride + way] == key) {
+            *set = s;
+            return way;
         }
     }
-    if (c->sets) {
-        free(c->sets);
+    return -1;
+}
+
+// Set addr maps to (in way 0, when skewed)
+uint64_t cache_addr_set(const cache_t *c, uint64_t addr)
+{
+    return cache_set_of(c, addr >> c->block_offset_bits, 0);
+}
+
+// Mark a line as just used, for a skewed cache's replacement
+static inline void cache_stamp(cache_t *c, uint64_t set_index, int way)
+{
+    c->line_stamp[set_index * c->way_stride + way] = ++c->stamp_clock;
+}
+
+void cache_destroy(cache_t *c)
+{
+    if (!c) return;
+    free(c->tags);
+    free(c->dirty);
+    free(c->prefetched);
+    free(c->sector_valid);
+    free(c->stat_sector_fills);
+    free(c->way_pred);
+    free(c->comp_size);
+    free(c->line_stamp);
+    free(c->pf);
+    free(c->repl_meta);
+    mclass_destroy(c->mclass);
+    free(c->mesi);
+    if (c->inbox) {
+        free(c->inbox->msgs);
+        free(c->inbox);
     }
+    cache_destroy(c->victim);
     free(c);
 
 }
 
+// Copy tags, replacement state and statistics between two caches of the
+// same geometry and policy
+void cache_copy(cache_t *dst, const cache_t *src)
+{
+    if (!dst || !src) return;
+    memcpy(dst->tags, src->tags, (size_t) src->num_sets * src->way_stride * sizeof(uint64_t));
+    memcpy(dst->dirty, src->dirty, (size_t) src->num_sets * src->way_stride);
+    memcpy(dst->prefetched, src->prefetched, (size_t) src->num_sets * src->way_stride);
+    if (dst->sector_valid && src->sector_valid) {
+        memcpy(dst->sector_valid, src->sector_valid,
+               (size_t) src->num_sets * src->way_stride * sizeof(uint64_t));
+        memcpy(dst->stat_sector_fills, src->stat_sector_fills,
+               (size_t) src->sectors * sizeof(uint64_t));
+    }
+    if (dst->comp_size && src->comp_size) {
+        memcpy(dst->comp_size, src->comp_size,
+               (size_t) src->num_sets * src->way_stride * sizeof(uint16_t));
+    }
+    if (dst->line_stamp && src->line_stamp) {
+        memcpy(dst->line_stamp, src->line_stamp,
+               (size_t) src->num_sets * src->way_stride * sizeof(uint64_t));
+        dst->stamp_clock = src->stamp_clock;
+    }
+    if (dst->way_pred && src->way_pred) {
+        memcpy(dst->way_pred, src->way_pred, (size_t) src->num_sets * sizeof(uint16_t));
+    }
+    if (dst->pf && src->pf) {
+        *dst->pf = *src->pf;
+    }
+    mclass_copy(dst->mclass, src->mclass);
+    if (dst->mesi && src->mesi) {
+        memcpy(dst->mesi, src->mesi, (size_t) src->num_sets * src->way_stride);
+    }
+    cache_copy(dst->victim, src->victim);
+    memcpy(dst->repl_meta, src->repl_meta,
+           (size_t) src->num_sets * src->repl_words * sizeof(uint64_t));
+    dst->rng = src->rng;
+    dst->evict_valid = src->evict_valid;
+    dst->evict_addr = src->evict_addr;
+    dst->stat_accesses = src->stat_accesses;
+    dst->stat_hits = src->stat_hits;
+    dst->stat_misses = src->stat_misses;
+    dst->stat_back_invalidations = src->stat_back_invalidations;
+    dst->stat_writebacks = src->stat_writebacks;
+    dst->stat_write_bytes = src->stat_write_bytes;
+    dst->stat_cross_evictions = src->stat_cross_evictions;
+    dst->stat_sector_misses = src->stat_sector_misses;
+    dst->stat_fill_bytes = src->stat_fill_bytes;
+    dst->stat_evicted_lines = src->stat_evicted_lines;
+    dst->stat_evicted_sectors = src->stat_evicted_sectors;
+    dst->stat_way_correct = src->stat_way_correct;
+    dst->stat_way_wrong = src->stat_way_wrong;
+    dst->stat_comp_fills = src->stat_comp_fills;
+    dst->stat_comp_bytes = src->stat_comp_bytes;
+    dst->stat_decompressions = src->stat_decompressions;
+    dst->stat_comp_evictions = src->stat_comp_evictions;
+}
+
+cache_t *cache_clone(const cache_t *src)
+{
+    if (!src) return NULL;
+    cache_t *c = cache_new(src->num_sets, src->num_ways, src->block_size);
+    c->name = src->name;
+    c->write_policy = src->write_policy;
+    cache_set_policy(c, src->policy);
+    cache_set_sectors(c, src->sectors);
+    cache_set_index_fn(c, src->index_fn);
+    cache_set_way_predict(c, src->way_pred != NULL);
+    if (src->comp_size) {
+        cache_set_compression(c, src->data_ways, src->decompress_latency, src->compress);
+    }
+    if (src->pf) {
+        cache_set_prefetcher(c, src->pf->policy, src->pf->degree, src->pf->distance);
+    }
+    cache_set_classify(c, src->mclass != NULL);
+    if (src->mesi) {
+        // The clone keeps its lines' states but does not join the bus
+        c->mesi = (uint8_t *) calloc((size_t) src->num_sets * src->way_stride, sizeof(uint8_t));
+        if (!c->mesi) {
+            fprintf(stderr, "Failed to allocate coherence state for %s\n", src->name);
+            exit(1);
+        }
+    }
+    c->victim = cache_clone(src->victim);
+    c->dram = src->dram;
+    cache_copy(c, src);
+    return c;
+}
+
 // Check for hit without modifying cache on miss
 int cache_check(cache_t *c, uint64_t addr)
 {
     if (!c) return 0;
     
-    uint64_t block_offset_mask = (1ULL << c->block_offset_bits) - 1;
-    uint64_t set_index_mask = (1ULL << c->set_index_bits) - 1;
+    uint64_t set_index;
+    
+    c->stat_accesses++;
+    
+    // Check for hit; in a sectored line the sector has to be valid too
+    int way = cache_find(c, addr, &set_index);
+    int hit = way >= 0 && cache_sector_valid(c, (int) (set_index * c->way_stride + way), addr);
+    if (c->mclass) {
+        mclass_access(c->mclass, addr, (int) set_index,
+                      hit ? MCLASS_HIT : way >= 0 ? MCLASS_SECTOR_MISS : MCLASS_MISS);
+    }
+
+    // A hit takes hit_latency cycles (at least one), a miss as long to
+    // find out; with way prediction only a hit in the predicted way is fast
+    c->lookup_cycles = c->hit_latency > 1 ? c->hit_latency : 1;
+    if (c->way_pred) {
+        if (hit && c->way_pred[set_index] == way) {
+            c->lookup_cycles = 1;
+            c->stat_way_correct++;
+        } else {
+            c->lookup_cycles++;
+            c->stat_way_wrong += (uint64_t) hit;
+        }
+    }
 
-    uint64_t set_index = (addr >> c->block_offset_bits) & set_index_mask;
-    uint64_t tag = addr >> (c->block_offset_bits + c->set_index_bits);
+    if (hit) {
+        // Cache hit - update replacement state
+        if (c->line_stamp) {
+            cache_stamp(c, set_index, way);
+        } else {
+            c->repl->touch(cache_set_meta(c, set_index), c->num_ways, way);
+        }
+        if (c->way_pred) {
+            c->way_pred[set_index] = (uint16_t) way;
+        }
+        if (c->comp_size && c->comp_size[set_index * c->way_stride + way] < c->block_size) {
+            c->lookup_cycles += c->decompress_latency;
+            c->stat_decompressions++;
+        }
+        c->stat_hits++;
+        uint8_t *line_prefetched = &c->prefetched[set_index * c->way_stride + way];
+        if (*line_prefetched) {
+            c->pf->stat_useful++;
+            *line_prefetched = 0;
+        }
+        return 1; // Hit
+    }
     
-    cache_set_t *set = &c->sets[set_index];
+    if (way >= 0) {
+        c->stat_sector_misses++;
+    }
+    c->stat_misses++;
+    return 0; // Miss - but don't insert anything
+}
+
+// Position of addr's line in tags[] (and the per-line flag arrays), or -1
+int cache_line_index(const cache_t *c, uint64_t addr)
+{
+    uint64_t set_index;
+    int way = cache_find(c, addr, &set_index);
+    return way < 0 ? -1 : (int) (set_index * c->way_stride + way);
+}
+
+// Whether addr is present, without touching statistics or replacement state
+int cache_probe(const cache_t *c, uint64_t addr)
+{
+    if (!c) return 0;
+    int line = cache_line_index(c, addr);
+    return line >= 0 && cache_sector_valid(c, line, addr);
+}
+
+// Pass written bytes on to the next level, or to DRAM behind the last one
+static void cache_write_out(cache_t *c, uint64_t addr, int bytes)
+{
+    c->stat_write_bytes += bytes;
+    if (c->next) {
+        cache_write(c->next, addr, bytes);
+    } else {
+        dram_write(c->dram, addr, bytes);
+    }
+}
+
+// Send a dirty block out to the next level (or memory)
+static void cache_writeback(cache_t *c, uint64_t addr)
+{
+    c->stat_writebacks++;
+    cache_write_out(c, addr, c->block_size);
+}
+
+static int cache_drop(cache_t *c, uint64_t addr, int *dirty);
+
+// cache_drop() for a cache inside this one. A core running on a thread of
+// its own drops the block at its next cycle and writes back any dirty data
+// from there.
+static int cache_drop_inner(cache_t *c, uint64_t addr, int *dirty)
+{
+    if (c->inbox) {
+        return cache_post(c, CACHE_MSG_INVALIDATE, addr);
+    }
+    return cache_drop(c, addr, dirty);
+}
+
+// Invalidate addr in c and, below an inclusive level, in every inner cache.
+// Sets *dirty if any dropped copy was dirty. Returns 1 if c held the block.
+static int cache_drop(cache_t *c, uint64_t addr, int *dirty)
+{
+    if (!c) return 0;
+
+    if (c->inclusion == CACHE_INCLUSIVE) {
+        for (int i = 0; i < c->num_inner; i++) {
+            cache_drop_inner(c->inner[i], addr, dirty);
+        }
+    }
+    // The victim buffer counts as part of this level
+    cache_drop(c->victim, addr, dirty);
+
+    uint64_t set_index;
+    int way = cache_find(c, addr, &set_index);
+    if (way < 0) return 0;
+    uint64_t *set_tags = cache_set_tags(c, set_index);
+    uint8_t *line_dirty = &c->dirty[set_index * c->way_stride + way];
+    *dirty |= *line_dirty;
+    *line_dirty = 0;
+    c->prefetched[set_index * c->way_stride + way] = 0;
+    if (c->mesi) {
+        c->mesi[set_index * c->way_stride + way] = MESI_I;
+    }
+    set_tags[way] = 0;
+    return 1;
+}
+
+static void cache_lock(cache_t *c)
+{
+    if (c->lock) pthread_mutex_lock(c->lock);
+}
+
+static void cache_unlock(cache_t *c)
+{
+    if (c->lock) pthread_mutex_unlock(c->lock);
+}
+
+// Send a block this level has just given up on to wherever it goes next
+static void cache_evict(cache_t *c, uint64_t victim, int victim_dirty)
+{
+    // Inclusive levels may not drop a block that an inner level still
+    // holds; dirty inner copies fold into the victim being written out
+    if (c->inclusion == CACHE_INCLUSIVE) {
+        for (int i = 0; i < c->num_inner; i++) {
+            c->stat_back_invalidations += cache_drop_inner(c->inner[i], victim, &victim_dirty);
+        }
+    }
+    if (c->victim) {
+        // The victim buffer takes the line, dirty data and all; whatever
+        // it pushes out continues to the next level from there
+        cache_insert(c->victim, victim);
+        if (victim_dirty) {
+            c->victim->dirty[cache_line_index(c->victim, victim)] = 1;
+        }
+        return;
+    }
+    // Exclusive outer levels are filled with what inner levels throw away
+    if (c->next && c->next->inclusion == CACHE_EXCLUSIVE) {
+        cache_insert(c->next, victim);
+    }
+    if (victim_dirty) {
+        cache_writeback(c, victim);
+    }
+}
+
+// In a compressed cache, evict lines of the set other than keep until the
+// set's lines fit in its data
+static void cache_make_room(cache_t *c, uint64_t set_index, int keep)
+{
+    uint64_t *set_tags = cache_set_tags(c, set_index);
+    uint64_t *meta = cache_set_meta(c, set_index);
+    size_t first = set_index * c->way_stride;
+    for (;;) {
+        int used = 0;
+        for (int w = 0; w < c->num_ways; w++) {
+            used += set_tags[w] ? c->comp_size[first + w] : 0;
+        }
+        if (used <= c->data_ways * c->block_size) return;
+
+        // The policy's victim, unless that is the new line (or an empty
+        // way), in which case the first other line goes
+        int way = c->repl->victim(meta, c->num_ways, &c->rng);
+        for (int w = 0; way == keep || !set_tags[way]; w++) {
+            way = w;
+        }
+        uint64_t victim = cache_block_addr(c, set_tags[way], set_index);
+        int victim_dirty = c->dirty[first + way];
+        if (c->prefetched[first + way]) {
+            c->pf->stat_useless++;
+        }
+        set_tags[way] = 0;
+        c->dirty[first + way] = 0;
+        c->prefetched[first + way] = 0;
+        if (c->mesi) {
+            c->mesi[first + way] = MESI_I;
+        }
+        c->stat_comp_evictions++;
+        cache_evict(c, victim, victim_dirty);
+    }
+}
+
+static void cache_fill(cache_t *c, uint64_t addr)
+{
+    uint64_t block = addr >> c->block_offset_bits;
+    uint64_t set_index;
+
+    // A prefetch and a demand fill may both bring the block in; another
+    // sector of a line already here just becomes valid
+    c->evict_valid = 0;
+    int way = cache_find(c, addr, &set_index);
+    if (way >= 0) {
+        uint64_t *valid = c->sector_valid ? &c->sector_valid[set_index * c->way_stride + way] : NULL;
+        if (valid && !((*valid >> cache_sector(c, addr)) & 1)) {
+            *valid |= 1ULL << cache_sector(c, addr);
+            c->stat_fill_bytes += (uint64_t) c->sector_size;
+            c->stat_sector_fills[cache_sector(c, addr)]++;
+        }
+        if (c->way_pred) {
+            c->way_pred[set_index] = (uint16_t) way;
+        }
+        return;
+    }
     
-    // Check for hit
-    for (int i = 0; i < c->num_ways; i++) {
-        cache_line_t *line = &set->lines[i];
-        if (line->valid && line->tag == tag) {
-            // Cache hit - update LRU
-            line->lru = 0;
-            for (int j = 0; j < c->num_ways; j++) {
-                if (j != i) {
-                    set->lines[j].lru++;
-                }
+    // Find line to replace: first invalid way (padding sits past num_ways),
+    // else ask the policy; skewed, the oldest of the block's candidate lines
+    int replace_index;
+    if (c->line_stamp) {
+        uint64_t oldest = 0;
+        replace_index = -1;
+        for (int w = 0; w < c->num_ways; w++) {
+            uint64_t s = cache_set_of(c, block, w);
+            size_t line = s * c->way_stride + w;
+            uint64_t stamp = c->tags[line] ? c->line_stamp[line] : 0;
+            if (replace_index < 0 || stamp < oldest) {
+                replace_index = w;
+                oldest = stamp;
+                set_index = s;
             }
-            return 1; // Hit
+        }
+    } else {
+        replace_index = cache_match(cache_set_tags(c, set_index), c->way_stride, 0);
+        if (replace_index < 0 || replace_index >= c->num_ways) {
+            replace_index = c->repl->victim(cache_set_meta(c, set_index), c->num_ways, &c->rng);
         }
     }
+    uint64_t *set_tags = cache_set_tags(c, set_index);
     
-    return 0; // Miss - but don't insert anything
+    // Remember the displaced block for the levels around this one
+    uint64_t old = set_tags[replace_index];
+    c->evict_valid = old != 0;
+    c->evict_addr = cache_block_addr(c, old, set_index);
+    if (c->evict_valid && (c->evict_addr ^ addr) >> CACHE_SPACE_SHIFT) {
+        c->stat_cross_evictions++;
+    }
+
+    // Replace the selected line; fills arrive clean
+    uint8_t *line_dirty = &c->dirty[set_index * c->way_stride + replace_index];
+    uint8_t *line_prefetched = &c->prefetched[set_index * c->way_stride + replace_index];
+    int victim_dirty = *line_dirty;
+    if (*line_prefetched) {
+        c->pf->stat_useless++;
+    }
+    set_tags[replace_index] = cache_tag_entry(block >> c->tag_shift);
+    *line_dirty = 0;
+    *line_prefetched = 0;
+    c->stat_fill_bytes += (uint64_t) c->sector_size;
+    if (c->comp_size) {
+        // Sized by what the block holds now, from its first byte; later
+        // stores do not resize it
+        int bytes = c->compress(block << c->block_offset_bits, c->block_size);
+        bytes = (bytes + CACHE_COMPRESS_SEGMENT - 1) / CACHE_COMPRESS_SEGMENT * CACHE_COMPRESS_SEGMENT;
+        bytes = bytes < c->block_size ? bytes : c->block_size;
+        c->comp_size[set_index * c->way_stride + replace_index] = (uint16_t) bytes;
+        c->stat_comp_fills++;
+        c->stat_comp_bytes += (uint64_t) bytes;
+    }
+    if (c->sector_valid) {
+        uint64_t *valid = &c->sector_valid[set_index * c->way_stride + replace_index];
+        if (c->evict_valid) {
+            c->stat_evicted_lines++;
+            c->stat_evicted_sectors += (uint64_t) __builtin_popcountll(*valid);
+        }
+        *valid = 1ULL << cache_sector(c, addr);
+        c->stat_sector_fills[cache_sector(c, addr)]++;
+    }
+    if (c->line_stamp) {
+        cache_stamp(c, set_index, replace_index);
+    } else {
+        c->repl->fill(cache_set_meta(c, set_index), c->num_ways, replace_index, &c->rng);
+    }
+    if (c->way_pred) {
+        c->way_pred[set_index] = (uint16_t) replace_index;
+    }
+    if (c->bus) {
+        coh_fill(c->bus, c, addr, (int) (set_index * c->way_stride + replace_index));
+    }
+
+    if (c->evict_valid) {
+        cache_evict(c, c->evict_addr, victim_dirty);
+    }
+    if (c->comp_size) {
+        cache_make_room(c, set_index, replace_index);
+    }
 }
 
 // Insert a block into the cache (call only when miss completes)
 void cache_insert(cache_t *c, uint64_t addr)
 {
     if (!c) return;
-    
-    uint64_t set_index_mask = (1ULL << c->set_index_bits) - 1;
+    cache_lock(c);
+    cache_fill(c, addr);
+    cache_unlock(c);
+}
 
-    uint64_t set_index = (addr >> c->block_offset_bits) & set_index_mask;
-    uint64_t tag = addr >> (c->block_offset_bits + c->set_index_bits);
-    
-    cache_set_t *set = &c->sets[set_index];
-    
-    // Find line to replace
-    int replace_index = 0;
-    uint64_t oldest_lru = set->lines[0].lru;
-    
-    for (int i = 0; i < c->num_ways; i++) {
-        if (!set->lines[i].valid) {
-            replace_index = i;
-            break;
+// Drop a block (and, below an inclusive level, every inner copy of it),
+// writing it back first if it was dirty. Returns 1 if this cache held it.
+int cache_invalidate(cache_t *c, uint64_t addr)
+{
+    int dirty = 0;
+    cache_lock(c);
+    int held = cache_drop(c, addr, &dirty);
+    if (dirty) {
+        cache_writeback(c, addr);
+    }
+    cache_unlock(c);
+    return held;
+}
+
+// Drop every line, this level's victim buffer included, writing dirty ones
+// back; returns the number of lines dropped
+int cache_flush(cache_t *c)
+{
+    if (!c) return 0;
+    int flushed = 0;
+    for (int set = 0; set < c->num_sets; set++) {
+        for (int way = 0; way < c->num_ways; way++) {
+            uint64_t entry = c->tags[set * c->way_stride + way];
+            if (!entry) continue;
+            uint64_t addr = cache_block_addr(c, entry, (uint64_t) set);
+            flushed += cache_invalidate(c, addr);
         }
-        if (set->lines[i].lru > oldest_lru) {
-            oldest_lru = set->lines[i].lru;
-            replace_index = i;
+    }
+    return flushed + cache_flush(c->victim);
+}
+
+// Write a dirty block back but keep it, now clean
+void cache_clean(cache_t *c, uint64_t addr)
+{
+    cache_lock(c);
+    int line = cache_line_index(c, addr);
+    if (line >= 0 && c->dirty[line]) {
+        c->dirty[line] = 0;
+        cache_writeback(c, addr);
+    }
+    cache_unlock(c);
+}
+
+static void cache_store(cache_t *c, uint64_t addr, int bytes)
+{
+    // Other cores' copies go before the store lands
+    if (c->bus) {
+        coh_write(c->bus, c, addr);
+    }
+
+    if (c->write_policy == CACHE_WRITE_BACK) {
+        int line = cache_line_index(c, addr);
+        if (line >= 0 && cache_sector_valid(c, line, addr)) {
+            c->dirty[line] = 1;
+            return;
         }
     }
-    
-    // Replace the selected line
-    set->lines[replace_index].valid = 1;
-    set->lines[replace_index].tag = tag;
-    set->lines[replace_index].lru = 0;
-    
-    // Increment LRU for all other valid lines
-    for (int i = 0; i < c->num_ways; i++) {
-        if (i != replace_index && set->lines[i].valid) {
-            set->lines[i].lru++;
+
+    cache_write_out(c, addr, bytes);
+}
+
+// Cycles a store to addr takes to complete at c: a write-back hit is
+// absorbed there in a cycle, anything else waits on the next level (or
+// memory)
+int cache_write_latency(const cache_t *c, uint64_t addr)
+{
+    if (c->write_policy == CACHE_WRITE_BACK && cache_probe(c, addr)) {
+        return 1;
+    }
+    if (c->next) {
+        return c->next->hit_latency > 1 ? c->next->hit_latency : 1;
+    }
+    return c->mem_latency;
+}
+
+// Store bytes at addr. A write-back level holding the block just marks it
+// dirty; otherwise the data goes on to the next level (no write-allocate
+// beyond the level the pipeline filled).
+void cache_write(cache_t *c, uint64_t addr, int bytes)
+{
+    if (!c) return;
+    cache_lock(c);
+    cache_store(c, addr, bytes);
+    cache_unlock(c);
+}
+
+// Place outer behind inner in the hierarchy
+void cache_attach(cache_t *inner, cache_t *outer)
+{
+    if (!inner || !outer) return;
+    if (outer->num_inner == CACHE_MAX_INNER) {
+        fprintf(stderr, "Too many inner caches behind %s\n", outer->name);
+        exit(1);
+    }
+    inner->next = outer;
+    outer->inner[outer->num_inner++] = inner;
+    if (inner->victim) {
+        inner->victim->next = outer;
+    }
+}
+
+// Give c a fully associative victim buffer of the given size (0 removes it)
+void cache_set_victim(cache_t *c, int entries, int hit_latency)
+{
+    cache_destroy(c->victim);
+    c->victim = NULL;
+    if (entries <= 0) return;
+
+    c->victim = cache_new(1, entries, c->block_size);
+    c->victim->name = "victim";
+    c->victim->hit_latency = hit_latency;
+    c->victim->write_policy = CACHE_WRITE_BACK;
+    c->victim->next = c->next;
+    c->victim->dram = c->dram;
+}
+
+// Put a DRAM model behind c, which must be a last level
+void cache_set_dram(cache_t *c, dram_t *dram)
+{
+    if (!c) return;
+    c->dram = dram;
+    if (c->victim) {
+        c->victim->dram = dram;
+    }
+}
+
+static int cache_fetch(cache_t *c, uint64_t addr)
+{
+    // A prefetch already on its way only has its remaining cycles left
+    if (c->pf) {
+        int q = prefetch_queue_find(c->pf, addr & ~((uint64_t) c->block_size - 1));
+        if (q >= 0) {
+            c->pf->stat_late++;
+            c->pf->queue[q].valid = 0;
+            return c->pf->queue[q].cycles_remaining;
+        }
+    }
+
+    // Recently evicted lines come back from the victim buffer. Its copy
+    // is dropped; any dirty data is written back now, since the refill from
+    // the pipeline will arrive clean.
+    if (c->victim && cache_check(c->victim, addr)) {
+        cache_invalidate(c->victim, addr);
+        return c->victim->hit_latency;
+    }
+
+    // A block another core owns comes straight from its cache
+    if (c->bus && coh_peer_owns(c->bus, c, addr)) {
+        return c->bus->transfer_cycles;
+    }
+
+    cache_t *outer = c->next;
+    if (!outer) {
+        return c->dram ? dram_read(c->dram, addr, c->sector_size) : c->mem_latency;
+    }
+
+    if (cache_check(outer, addr)) {
+        // The block moves up out of an exclusive level
+        if (outer->inclusion == CACHE_EXCLUSIVE) {
+            cache_invalidate(outer, addr);
         }
+        return outer->hit_latency;
     }
+
+    int latency = outer->hit_latency + cache_miss_latency(outer, addr);
+    if (outer->inclusion != CACHE_EXCLUSIVE) {
+        cache_insert(outer, addr);
+    }
+    return latency;
 }
 
+// Called on a miss in c: look the block up in the levels behind c and return
+// the cycles until it arrives. Outer levels are filled here according to their
+// inclusion policy; c itself is filled by the caller through cache_insert()
+// once the miss resolves.
+int cache_miss_latency(cache_t *c, uint64_t addr)
+{
+    cache_lock(c);
+    int latency = cache_fetch(c, addr);
+    cache_unlock(c);
+    return latency;
+}
 
-int cache_update(cache_t *c, uint64_t addr)
+// Feed a demand access to the prefetcher and start fetching whatever it
+// asks for that is neither present nor already on its way
+void cache_train(cache_t *c, uint64_t pc, uint64_t addr, int hit)
 {
-    if (!c) return 0;
-    
-    uint64_t block_offset_mask = (1ULL << c->block_offset_bits) - 1;
-    uint64_t set_index_mask = (1ULL << c->set_index_bits) - 1;
+    if (!c || !c->pf) return;
 
-    uint64_t block_offset = addr & block_offset_mask;
-    uint64_t set_index = (addr >> c->block_offset_bits) & set_index_mask;
-    uint64_t tag = addr >> (c->block_offset_bits + c->set_index_bits);
-    
-    cache_set_t *set = &c->sets[set_index];
-    
-    // Check for hit
-    for (int i = 0; i < c->num_ways; i++) {
-        cache_line_t *line = &set->lines[i];
-        if (line->valid && line->tag == tag) {
-            // Cache hit - reset LRU to 0, increment others
-            line->lru = 0;
-            for (int j = 0; j < c->num_ways; j++) {
-                if (j != i) {
-                    set->lines[j].lru++;
-                }
-            }
-            return 1; // Hit
+    uint64_t block_mask = ~((uint64_t) c->block_size - 1);
+    uint64_t candidates[PF_MAX_DEGREE];
+    int n = prefetch_train(c->pf, pc, addr, c->block_offset_bits, hit, candidates);
+    for (int i = 0; i < n; i++) {
+        uint64_t block = candidates[i] & block_mask;
+        if (block == (addr & block_mask) || cache_probe(c, block) ||
+            prefetch_queue_find(c->pf, block) >= 0) {
+            continue;
+        }
+        if (prefetch_queue_full(c->pf)) {
+            c->pf->stat_dropped++;
+            continue;
         }
+        prefetch_queue_push(c->pf, block, cache_miss_latency(c, block));
     }
-    
-    // Cache miss - find line to replace
-    int replace_index = 0;
-    uint64_t oldest_lru = set->lines[0].lru;
-    
-    for (int i = 0; i < c->num_ways; i++) {
-        // Prefer invalid lines first
-        if (!set->lines[i].valid) {
-            replace_index = i;
-            break;
+}
+
+// Advance in-flight prefetches by a cycle and fill the ones that arrive
+void cache_tick(cache_t *c)
+{
+    if (!c || !c->pf) return;
+
+    for (int i = 0; i < PF_QUEUE; i++) {
+        pf_request_t *r = &c->pf->queue[i];
+        if (!r->valid || --r->cycles_remaining > 0) continue;
+        r->valid = 0;
+        if (cache_probe(c, r->block_addr)) continue;
+
+        cache_insert(c, r->block_addr);
+        c->prefetched[cache_line_index(c, r->block_addr)] = 1;
+    }
+}
+
+// Make c a cache that a core on its own thread owns: lock (recursive) is
+// held whenever c reaches beyond itself, and other threads' actions on c
+// go through its inbox. NULL makes c direct again.
+void cache_set_lock(cache_t *c, pthread_mutex_t *lock)
+{
+    if (!c) return;
+    c->lock = lock;
+    if (lock && !c->inbox) {
+        c->inbox = (cache_inbox_t *) calloc(1, sizeof(cache_inbox_t));
+        if (!c->inbox) {
+            fprintf(stderr, "Failed to allocate inbox for %s\n", c->name);
+            exit(1);
         }
-        // Find the line with HIGHEST lru value (oldest)
-        if (set->lines[i].lru > oldest_lru) {  // Changed from < to >
-            oldest_lru = set->lines[i].lru;
-            replace_index = i;
+    }
+}
+
+// Queue an action for c's owner, if c (or its victim buffer) holds addr;
+// the caller holds the lock. Returns 1 if c itself holds the block.
+int cache_post(cache_t *c, cache_msg_kind_t kind, uint64_t addr)
+{
+    int held = cache_probe(c, addr);
+    if (!held && !cache_probe(c->victim, addr)) return 0;
+
+    cache_inbox_t *in = c->inbox;
+    if (in->count == in->size) {
+        in->size = in->size ? 2 * in->size : 16;
+        in->msgs = (cache_msg_t *) realloc(in->msgs, (size_t) in->size * sizeof(cache_msg_t));
+        if (!in->msgs) {
+            fprintf(stderr, "Failed to allocate inbox for %s\n", c->name);
+            exit(1);
         }
     }
-    
-    // Replace the selected line
-    set->lines[replace_index].valid = 1;
-    set->lines[replace_index].tag = tag;
-    set->lines[replace_index].lru = 0;  // New line gets LRU = 0
-    
-    // Increment LRU for all other valid lines in this set
-    for (int i = 0; i < c->num_ways; i++) {
-        if (i != replace_index && set->lines[i].valid) {
-            set->lines[i].lru++;
+    in->msgs[in->count].kind = kind;
+    in->msgs[in->count].addr = addr;
+    __atomic_store_n(&in->count, in->count + 1, __ATOMIC_RELEASE);
+    return held;
+}
+
+// Apply what the other cores' threads queued for c; called by its owner
+void cache_drain(cache_t *c)
+{
+    if (!c || !c->inbox || !__atomic_load_n(&c->inbox->count, __ATOMIC_ACQUIRE)) return;
+
+    cache_lock(c);
+    for (int i = 0; i < c->inbox->count; i++) {
+        cache_msg_t *m = &c->inbox->msgs[i];
+        if (m->kind == CACHE_MSG_INVALIDATE) {
+            cache_invalidate(c, m->addr);
+        } else {
+            coh_share(c, m->addr);
         }
     }
-    
+    __atomic_store_n(&c->inbox->count, 0, __ATOMIC_RELEASE);
+    cache_unlock(c);
+}
+
+void cache_print_stats(FILE *out, const cache_t *c)
+{
+    static const char *inclusion_names[] = { "non-inclusive", "inclusive", "exclusive" };
+
+    if (!c) return;
+    fprintf(out, "%s: %d sets x %d ways x %d B (%d KB), %s, %s, hit latency %d, %s\n",
+            c->name, c->num_sets, c->num_ways, c->block_size,
+            c->num_sets * (c->comp_size ? c->data_ways : c->num_ways) * c->block_size / 1024,
+            c->repl->name, c->write_policy == CACHE_WRITE_BACK ? "write-back" : "write-through",
+            c->hit_latency, inclusion_names[c->inclusion]);
+    if (c->index_fn == CACHE_INDEX_XOR) {
+        fprintf(out, "  set index: XOR of the block number's %d-bit slices\n", c->set_index_bits);
+    } else if (c->index_fn == CACHE_INDEX_PRIME) {
+        fprintf(out, "  set index: block number mod %d (%d sets unused)\n",
+                c->index_prime, c->num_sets - c->index_prime);
+    } else if (c->index_fn == CACHE_INDEX_SKEW) {
+        fprintf(out, "  set index: skewed, a hash per way; the oldest of a block's %d lines is"
+                " replaced\n", c->num_ways);
+    }
+    fprintf(out, "  accesses %" PRIu64 ", hits %" PRIu64 ", misses %" PRIu64 ", miss rate %.2f%%\n",
+            c->stat_accesses, c->stat_hits, c->stat_misses,
+            c->stat_accesses ? 100.0 * c->stat_misses / c->stat_accesses : 0.0);
+    mclass_print_stats(out, c->mclass);
+    if (c->stat_back_invalidations) {
+        fprintf(out, "  back-invalidations %" PRIu64 "\n", c->stat_back_invalidations);
+    }
+    prefetch_print_stats(out, c->pf, c->stat_misses);
+    if (c->victim) {
+        fprintf(out, "  victim buffer: %d entries, hit latency %d, probes %" PRIu64
+                ", misses saved %" PRIu64 ", writebacks %" PRIu64 "\n",
+                c->victim->num_ways, c->victim->hit_latency, c->victim->stat_accesses,
+                c->victim->stat_hits, c->victim->stat_writebacks);
+    }
+    if (c->stat_write_bytes) {
+        fprintf(out, "  writebacks %" PRIu64 ", bytes written to %s %" PRIu64 "\n",
+                c->stat_writebacks, c->next ? c->next->name : "memory", c->stat_write_bytes);
+    }
+    if (c->sector_valid) {
+        fprintf(out, "  %d sectors x %d B under %d tags: sector misses %" PRIu64
+                " (line present), line misses %" PRIu64 "\n",
+                c->sectors, c->sector_size, c->num_sets * c->num_ways,
+                c->stat_sector_misses, c->stat_misses - c->stat_sector_misses);
+        fprintf(out, "  bytes fetched %" PRIu64 " (%.2f per access), sectors valid per evicted line %.2f\n",
+                c->stat_fill_bytes,
+                c->stat_accesses ? (double) c->stat_fill_bytes / c->stat_accesses : 0.0,
+                c->stat_evicted_lines ? (double) c->stat_evicted_sectors / c->stat_evicted_lines : 0.0);
+        fprintf(out, "  fills by sector:");
+        for (int i = 0; i < c->sectors; i++) {
+            fprintf(out, " %" PRIu64, c->stat_sector_fills[i]);
+        }
+        fprintf(out, "\n");
+    }
+    if (c->comp_size) {
+        // Effective capacity: the data scaled by the compression ratio,
+        // up to what the tags can name
+        double ratio = c->stat_comp_bytes ? (double) c->stat_comp_fills * c->block_size / c->stat_comp_bytes : 1.0;
+        double scale = ratio < (double) c->num_ways / c->data_ways ? ratio : (double) c->num_ways / c->data_ways;
+        int data_kb = c->num_sets * c->data_ways * c->block_size / 1024;
+        uint64_t lines = 0;
+        for (int s = 0; s < c->num_sets; s++) {
+            for (int w = 0; w < c->num_ways; w++) {
+                lines += c->tags[(size_t) s * c->way_stride + w] != 0;
+            }
+        }
+        fprintf(out, "  compressed (BDI): %d tags sharing %d blocks of data per set,"
+                " decompression %d cycles\n", c->num_ways, c->data_ways, c->decompress_latency);
+        fprintf(out, "  compression ratio %.2f over %" PRIu64 " fills, decompressions %" PRIu64
+                ", evictions for room %" PRIu64 "\n",
+                ratio, c->stat_comp_fills, c->stat_decompressions, c->stat_comp_evictions);
+        fprintf(out, "  effective capacity %.1f KB of %d KB data (%.2fx), %.1f KB of blocks held now\n",
+                data_kb * scale, data_kb, scale, (double) lines * c->block_size / 1024);
+    }
+    if (c->way_pred) {
+        fprintf(out, "  way prediction (MRU): correct %" PRIu64 ", wrong %" PRIu64
+                ", accuracy %.2f%% of hits\n",
+                c->stat_way_correct, c->stat_way_wrong,
+                c->stat_hits ? 100.0 * c->stat_way_correct / c->stat_hits : 0.0);
+    }
+    if (c->stat_cross_evictions) {
+        fprintf(out, "  lines of other processes evicted %" PRIu64 "\n", c->stat_cross_evictions);
+    }
+}
+
+
+// Lookup that allocates on a miss
+int cache_update(cache_t *c, uint64_t addr)
+{
+    if (!c) return 0;
+    if (cache_check(c, addr)) {
+        return 1; // Hit
+    }
+    cache_insert(c, addr);
     return 0; // Miss
 }
@@ -8,33 +8,215 @@
 #define _CACHE_H_
 
 #include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "repl.h"
+#include "prefetch.h"
+#include "dram.h"
+#include "mclass.h"
+#include "coherence.h"
 
-typedef struct cache_line {
-    int valid;
-    uint64_t tag;
-    uint64_t lru;
-} cache_line_t;
+/* most caches that can sit directly inside one outer level (an L1I and an
+ * L1D for each of up to 8 cores) */
+#define CACHE_MAX_INNER 16
 
-typedef struct cache_set {
-    cache_line_t *lines;
-} cache_set_t;
+/* How an outer level relates to the caches inside it */
+typedef enum {
+    CACHE_NON_INCLUSIVE = 0,   /* filled on misses, never back-invalidates */
+    CACHE_INCLUSIVE,           /* evictions back-invalidate inner copies */
+    CACHE_EXCLUSIVE            /* only holds blocks evicted from inner levels */
+} cache_inclusion_t;
 
-typedef struct
+/* What a level does with store data */
+typedef enum {
+    CACHE_WRITE_THROUGH = 0,   /* every store is passed on to the next level */
+    CACHE_WRITE_BACK           /* stores dirty the line; written out on eviction */
+} cache_write_policy_t;
+
+/* How a block picks its set */
+typedef enum {
+    CACHE_INDEX_MODULO = 0,    /* the low bits of the block number */
+    CACHE_INDEX_XOR,           /* every set-index-wide slice of the block number XORed */
+    CACHE_INDEX_PRIME,         /* block number mod the largest prime <= sets */
+    CACHE_INDEX_SKEW           /* skewed-associative: a different hash in every way */
+} cache_index_t;
+
+/* Tag storage is one 64-byte aligned array, set-major, with way_stride
+ * entries per set (num_ways rounded up to a multiple of 8) so that vector
+ * compares never straddle two sets. A valid entry holds (tag << 1) | 1 and
+ * an invalid one holds 0; padding entries stay 0 and never match. */
+#define CACHE_WAY_ALIGN 8
+
+/* Time-sliced processes each have an address space of their own, numbered
+ * in the address bits from CACHE_SPACE_SHIFT up, so one process never hits
+ * on another's lines and displacing them counts as pollution */
+#define CACHE_SPACE_SHIFT 48
+
+/* A compressed cache packs its blocks into a set's data in segments of
+ * this many bytes */
+#define CACHE_COMPRESS_SEGMENT 8
+
+/* Actions one core's thread takes on another core's cache while the cores
+ * run in parallel; the owner applies them in cache_drain() */
+typedef enum {
+    CACHE_MSG_INVALIDATE = 0,  /* drop the block, writing it back if dirty */
+    CACHE_MSG_SHARE            /* give up ownership: write back, keep it Shared */
+} cache_msg_kind_t;
+
+typedef struct {
+    cache_msg_kind_t kind;
+    uint64_t addr;
+} cache_msg_t;
+
+typedef struct {
+    cache_msg_t *msgs;
+    int count;               /* read without the lock by the owner */
+    int size;
+} cache_inbox_t;
+
+typedef struct cache
 {
     int num_sets;
     int num_ways;
     int block_size;
-    cache_set_t *sets;
+    uint64_t *tags;
+    uint8_t *dirty;          /* one flag per tag entry, same layout as tags */
+    uint8_t *prefetched;     /* filled by a prefetch and not yet used */
+    int way_stride;
 
     int block_offset_bits;
     int set_index_bits;
     int tag_bits;
+
+    /* set indexing: index_fn maps a block to its set (to one set per way
+     * when skewed); every function but modulo keeps the whole block number
+     * in the tag (tag_shift = 0). A skewed cache replaces the least
+     * recently used of the lines a block can go to, by line_stamp. */
+    cache_index_t index_fn;
+    int index_prime;
+    int tag_shift;
+    uint64_t *line_stamp;
+    uint64_t stamp_clock;
+
+    /* sectored lines: one tag covers sectors sub-blocks of sector_size
+     * bytes, each valid (and filled) on its own; sector_valid holds a bit
+     * per sector for every tag entry, NULL = whole-line fills */
+    int sectors;
+    int sector_size;
+    int sector_offset_bits;
+    uint64_t *sector_valid;
+
+    /* MRU way prediction: way_pred holds the way each set used last, which
+     * a lookup reads first, NULL = all ways read in parallel; lookup_cycles
+     * is what the last cache_check() took */
+    uint16_t *way_pred;
+    int lookup_cycles;
+
+    /* compression: the num_ways tags of a set share data_ways blocks of
+     * data, and each line takes comp_size bytes of it, as compress() says
+     * for the block's contents when it is filled; NULL = uncompressed */
+    int (*compress)(uint64_t addr, int block_size);
+    int data_ways;
+    int decompress_latency;  /* extra cycles to hit on a compressed line */
+    uint16_t *comp_size;
+
+    /* replacement: repl_words of policy state per set, set-major */
+    repl_policy_t policy;
+    const repl_ops_t *repl;
+    uint64_t *repl_meta;
+    int repl_words;
+    uint64_t rng;
+
+    /* hierarchy */
+    const char *name;
+    int hit_latency;         /* cycles to return a block found here */
+    int mem_latency;         /* cycles to memory when there is no next level */
+    cache_inclusion_t inclusion;
+    cache_write_policy_t write_policy;
+    struct cache *next;      /* next level out, NULL = memory */
+    dram_t *dram;            /* memory model behind the last level, NULL = mem_latency */
+    struct cache *inner[CACHE_MAX_INNER];
+    int num_inner;
+
+    /* small fully associative buffer for lines this level evicts */
+    struct cache *victim;
+
+    /* prefetcher trained by cache_train(), NULL = none */
+    prefetcher_t *pf;
+
+    /* 3C classification of cache_check() misses, NULL = off */
+    mclass_t *mclass;
+
+    /* MESI bus shared with the other cores' caches, NULL = not coherent;
+     * mesi holds one mesi_state_t per tag entry */
+    coh_bus_t *bus;
+    int bus_id;
+    uint8_t *mesi;
+
+    /* Set on a core's L1s while the cores run on their own threads with a
+     * quantum: lock guards this cache's tags and everything behind it, and
+     * the other threads' actions on it queue in inbox, NULL = direct */
+    pthread_mutex_t *lock;
+    cache_inbox_t *inbox;
+
+    /* last block displaced by cache_insert() */
+    int evict_valid;
+    uint64_t evict_addr;
+
+    /* statistics */
+    uint64_t stat_accesses;
+    uint64_t stat_hits;
+    uint64_t stat_misses;
+    uint64_t stat_back_invalidations;
+    uint64_t stat_writebacks;      /* dirty blocks written out on eviction */
+    uint64_t stat_write_bytes;     /* store and writeback bytes sent to next level */
+    uint64_t stat_cross_evictions; /* fills that displaced another address space's line */
+    uint64_t stat_sector_misses;   /* misses whose line was present, sector invalid */
+    uint64_t stat_fill_bytes;      /* bytes brought in by fills */
+    uint64_t stat_evicted_lines;
+    uint64_t stat_evicted_sectors; /* valid sectors of the lines evicted */
+    uint64_t *stat_sector_fills;   /* fills of each sector position */
+    uint64_t stat_way_correct;     /* hits in the predicted way */
+    uint64_t stat_way_wrong;       /* hits in another way */
+    uint64_t stat_comp_fills;
+    uint64_t stat_comp_bytes;      /* bytes the filled blocks took, compressed */
+    uint64_t stat_decompressions;  /* hits on compressed lines */
+    uint64_t stat_comp_evictions;  /* lines evicted to make room for a larger one */
 } cache_t;
 
 cache_t *cache_new(int sets, int ways, int block);
 void cache_destroy(cache_t *c);
+void cache_copy(cache_t *dst, const cache_t *src);
+cache_t *cache_clone(const cache_t *src);
+void cache_set_policy(cache_t *c, repl_policy_t policy);
+void cache_set_prefetcher(cache_t *c, prefetch_policy_t policy, int degree, int distance);
+void cache_set_classify(cache_t *c, int on);
+void cache_set_sectors(cache_t *c, int sectors);
+void cache_set_way_predict(cache_t *c, int on);
+void cache_set_compression(cache_t *c, int data_ways, int decompress_latency,
+                           int (*compress)(uint64_t addr, int block_size));
+void cache_set_index_fn(cache_t *c, cache_index_t fn);
+uint64_t cache_addr_set(const cache_t *c, uint64_t addr);
 int cache_update(cache_t *c, uint64_t addr);
 void cache_insert(cache_t *c, uint64_t addr);
 int cache_check(cache_t *c, uint64_t addr);
+int cache_probe(const cache_t *c, uint64_t addr);
+int cache_line_index(const cache_t *c, uint64_t addr);
+int cache_invalidate(cache_t *c, uint64_t addr);
+void cache_clean(cache_t *c, uint64_t addr);
+int cache_flush(cache_t *c);
+void cache_write(cache_t *c, uint64_t addr, int bytes);
+int cache_write_latency(const cache_t *c, uint64_t addr);
+void cache_train(cache_t *c, uint64_t pc, uint64_t addr, int hit);
+void cache_tick(cache_t *c);
+void cache_set_lock(cache_t *c, pthread_mutex_t *lock);
+int cache_post(cache_t *c, cache_msg_kind_t kind, uint64_t addr);
+void cache_drain(cache_t *c);
+
+void cache_attach(cache_t *inner, cache_t *outer);
+void cache_set_victim(cache_t *c, int entries, int hit_latency);
+void cache_set_dram(cache_t *c, dram_t *dram);
+int cache_miss_latency(cache_t *c, uint64_t addr);
+void cache_print_stats(FILE *out, const cache_t *c);
 
 #endif
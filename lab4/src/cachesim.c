@@ -0,0 +1,509 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Trace-driven cache simulator. Streams a binary address trace through one
+ * or more cache hierarchies built from cache_t, without the pipeline, and
+ * reports per-level miss rates and the average miss penalty.
+ *
+ * A trace is a sequence of 8-byte records in host byte order: bits 0-61
+ * hold the address, bits 62-63 the kind (0 = instruction fetch, 1 = data
+ * read, 2 = data write; 3 is reserved and counts as a read). "-" reads the
+ * trace from stdin.
+ *
+ * Each -H option adds a hierarchy, e.g.
+ *     -H l1i=64x4x32,l1d=256x8x32,l2=512x16x64:15,mem=50
+ * where a level is sets x ways x block[/sectors][:hit cycles]. Levels left
+ * out of a spec are absent; without l1i, fetches share the L1D. With no -H
+ * the hierarchy is the pipeline's own, from the knobs in pipe.h. Prefetchers,
+ * MSHRs and the DRAM model need a clock and stay with the pipeline.
+ *
+ * Every hierarchy sees each access once, in order. With -j N the
+ * hierarchies are dealt round-robin to N worker threads that step through
+ * the trace in lockstep, one chunk at a time; -f file reads more specs,
+ * one per line. repl=NAME in a spec sets the replacement policy of all
+ * its levels, so one run can compare geometries and policies side by side;
+ * index=MOD|XOR|PRIME|SKEW likewise sets their set index function, and
+ * waypred=1 gives both L1s an MRU way predictor.
+ *
+ * -c file also profiles stack distances of the fetch and data streams (at
+ * the first hierarchy's L1 block sizes) and writes the LRU miss-ratio
+ * curves of every cache size to file as CSV. -m splits every level's misses
+ * into compulsory, capacity and conflict misses and shows the conflicts of
+ * each set as a heatmap.
+ */
+
+#include "pipe.h"
+#include "cache.h"
+#include "sdist.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sys/sysinfo.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TRACE_KIND_SHIFT 62
+#define TRACE_ADDR_MASK  ((1ULL << TRACE_KIND_SHIFT) - 1)
+#define TRACE_FETCH      0
+#define TRACE_READ       1
+#define TRACE_WRITE      2
+
+#define TRACE_CHUNK      (1 << 16)   /* records per buffered read */
+#define BATCH            64         /* records whose L1 sets are prefetched together */
+#define MAX_HIERARCHIES  256
+#define STORE_BYTES      8
+
+typedef struct level_cfg {
+    int sets, ways, block, hit, sectors;
+} level_cfg_t;
+
+/* Cache-line aligned: neighbours usually belong to different threads */
+typedef struct hierarchy {
+    const char *spec;
+    cache_t *l1i, *l1d, *l2, *l3;
+    uint64_t accesses[3];            /* by trace kind */
+    uint64_t miss_cycles;            /* cycles spent beyond the L1s */
+} __attribute__((aligned(64))) hierarchy_t;
+
+typedef struct worker {
+    pthread_t thread;
+    hierarchy_t *h;
+    const char **specs;              /* NULL = the pipe.h hierarchy */
+    int first, count, stride;        /* hierarchies first, first + stride, ... */
+} worker_t;
+
+/* -m: classify misses */
+static int classify;
+
+/* chunk every worker runs next; 0 records ends the run */
+static const uint64_t *chunk_rec;
+static size_t chunk_len;
+static pthread_barrier_t chunk_ready, chunk_done;
+
+typedef struct trace {
+    const uint64_t *map;             /* whole file when it could be mapped */
+    size_t map_len;
+    size_t count, pos;
+    FILE *f;                         /* otherwise buffered reads into buf */
+    uint64_t *buf;
+} trace_t;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-H spec]... [-f specfile] [-j threads] [-c curves.csv] [-m] trace|-\n", prog);
+    fprintf(stderr, "  spec: level=SETSxWAYSxBLOCK[/SECTORS][:HIT],... with level l1i, l1d, l2, l3;"
+            " mem=CYCLES; repl=LRU|PLRU|SRRIP|BRRIP|random; index=MOD|XOR|PRIME|SKEW; waypred=0|1\n");
+    exit(1);
+}
+
+static cache_t *level_new(const char *name, const level_cfg_t *cfg, repl_policy_t policy,
+                          cache_index_t index, cache_inclusion_t inclusion,
+                          cache_write_policy_t write_policy)
+{
+    if (cfg->sets <= 0) return NULL;
+    cache_t *c = cache_new(cfg->sets, cfg->ways, cfg->block);
+    c->name = name;
+    c->hit_latency = cfg->hit;
+    c->inclusion = inclusion;
+    c->write_policy = write_policy;
+    cache_set_policy(c, policy);
+    cache_set_sectors(c, cfg->sectors);
+    cache_set_index_fn(c, index);
+    cache_set_classify(c, classify);
+    return c;
+}
+
+static void parse_level(const char *spec, const char *value, level_cfg_t *cfg)
+{
+    int n = 0;
+    cfg->hit = 0;
+    cfg->sectors = 1;
+    if (sscanf(value, "%dx%dx%d%n", &cfg->sets, &cfg->ways, &cfg->block, &n) < 3) {
+        fprintf(stderr, "Bad level '%s' in hierarchy '%s'\n", value, spec);
+        exit(1);
+    }
+    char *rest = (char *) value + n;
+    if (*rest == '/') {
+        cfg->sectors = (int) strtol(rest + 1, &rest, 10);
+    }
+    if (*rest == ':') {
+        cfg->hit = (int) strtol(rest + 1, &rest, 10);
+    }
+    if (*rest) {
+        fprintf(stderr, "Bad level '%s' in hierarchy '%s'\n", value, spec);
+        exit(1);
+    }
+}
+
+// Build a hierarchy from a spec, or from the pipe.h knobs when spec is NULL
+static void hierarchy_init(hierarchy_t *h, const char *spec)
+{
+    level_cfg_t l1i = { ICACHE_SETS, ICACHE_WAYS, ICACHE_BLOCK, ICACHE_HIT_CYCLES, ICACHE_SECTORS };
+    level_cfg_t l1d = { DCACHE_SETS, DCACHE_WAYS, DCACHE_BLOCK, DCACHE_HIT_CYCLES, DCACHE_SECTORS };
+    level_cfg_t l2 = { L2_SETS, L2_WAYS, L2_BLOCK, L2_HIT_CYCLES, L2_SECTORS };
+    level_cfg_t l3 = { L2_SETS > 0 ? L3_SETS : 0, L3_WAYS, L3_BLOCK, L3_HIT_CYCLES, L3_SECTORS };
+    int mem = MEM_CYCLES;
+    int waypred[2] = { ICACHE_WAY_PREDICT, DCACHE_WAY_PREDICT };
+    repl_policy_t repl[4] = { ICACHE_REPL, DCACHE_REPL, L2_REPL, L3_REPL };
+    cache_index_t index[4] = { ICACHE_INDEX, DCACHE_INDEX, L2_INDEX, L3_INDEX };
+
+    memset(h, 0, sizeof(*h));
+    h->spec = spec ? spec : "pipe.h defaults";
+    if (spec) {
+        l1i.sets = l1d.sets = l2.sets = l3.sets = 0;
+        char *copy = strdup(spec), *save = NULL;
+        for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+            char *value = strchr(tok, '=');
+            if (!value) usage("cachesim");
+            *value++ = '\0';
+            if (!strcmp(tok, "l1i")) parse_level(spec, value, &l1i);
+            else if (!strcmp(tok, "l1d")) parse_level(spec, value, &l1d);
+            else if (!strcmp(tok, "l2")) parse_level(spec, value, &l2);
+            else if (!strcmp(tok, "l3")) parse_level(spec, value, &l3);
+            else if (!strcmp(tok, "mem")) mem = atoi(value);
+            else if (!strcmp(tok, "waypred")) waypred[0] = waypred[1] = atoi(value);
+            else if (!strcmp(tok, "repl")) {
+                repl_policy_t policy = REPL_LRU;
+                while (strcasecmp(repl_get_ops(policy)->name, value) != 0) {
+                    if (policy == REPL_RANDOM) {
+                        fprintf(stderr, "Unknown policy '%s' in hierarchy '%s'\n", value, spec);
+                        exit(1);
+                    }
+                    policy++;
+                }
+                repl[0] = repl[1] = repl[2] = repl[3] = policy;
+            } else if (!strcmp(tok, "index")) {
+                static const char *names[] = { "MOD", "XOR", "PRIME", "SKEW" };
+                cache_index_t fn = CACHE_INDEX_MODULO;
+                while (strcasecmp(names[fn], value) != 0) {
+                    if (fn == CACHE_INDEX_SKEW) {
+                        fprintf(stderr, "Unknown index function '%s' in hierarchy '%s'\n", value, spec);
+                        exit(1);
+                    }
+                    fn++;
+                }
+                index[0] = index[1] = index[2] = index[3] = fn;
+            } else {
+                fprintf(stderr, "Unknown level '%s' in hierarchy '%s'\n", tok, spec);
+                exit(1);
+            }
+        }
+        free(copy);
+        if (l1d.sets <= 0 || (l3.sets > 0 && l2.sets <= 0)) {
+            fprintf(stderr, "Hierarchy '%s' needs an l1d, and an l2 below any l3\n", spec);
+            exit(1);
+        }
+    }
+
+    h->l1i = level_new("L1I", &l1i, repl[0], index[0], CACHE_NON_INCLUSIVE, CACHE_WRITE_THROUGH);
+    h->l1d = level_new("L1D", &l1d, repl[1], index[1], CACHE_NON_INCLUSIVE, DCACHE_WRITE_POLICY);
+    h->l2 = level_new("L2", &l2, repl[2], index[2], L2_INCLUSION, L2_WRITE_POLICY);
+    h->l3 = level_new("L3", &l3, repl[3], index[3], L3_INCLUSION, L3_WRITE_POLICY);
+    if (h->l1i) cache_set_way_predict(h->l1i, waypred[0]);
+    cache_set_way_predict(h->l1d, waypred[1]);
+    if (!spec) {
+        cache_set_victim(h->l1d, DCACHE_VICTIM_ENTRIES, DCACHE_VICTIM_HIT_CYCLES);
+    }
+
+    cache_t *last = NULL;
+    if (h->l2) {
+        if (h->l1i) cache_attach(h->l1i, h->l2);
+        cache_attach(h->l1d, h->l2);
+        last = h->l2;
+        if (h->l3) {
+            cache_attach(h->l2, h->l3);
+            last = h->l3;
+        }
+    }
+    if (last) {
+        last->mem_latency = mem;
+    } else {
+        if (h->l1i) h->l1i->mem_latency = mem;
+        h->l1d->mem_latency = mem;
+    }
+}
+
+static inline cache_t *hierarchy_l1(const hierarchy_t *h, int kind)
+{
+    return kind == TRACE_FETCH && h->l1i ? h->l1i : h->l1d;
+}
+
+static inline void hierarchy_access(hierarchy_t *h, uint64_t rec)
+{
+    int kind = (int) (rec >> TRACE_KIND_SHIFT);
+    uint64_t addr = rec & TRACE_ADDR_MASK;
+    if (kind > TRACE_WRITE) kind = TRACE_READ;
+    cache_t *l1 = hierarchy_l1(h, kind);
+
+    h->accesses[kind]++;
+    if (!cache_check(l1, addr)) {
+        h->miss_cycles += cache_miss_latency(l1, addr);
+        cache_insert(l1, addr);
+    }
+    if (kind == TRACE_WRITE) {
+        cache_write(l1, addr, STORE_BYTES);
+    }
+}
+
+static void profile_run(sdist_t *isdist, sdist_t *dsdist, const uint64_t *rec, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint64_t addr = rec[i] & TRACE_ADDR_MASK;
+        sdist_access((rec[i] >> TRACE_KIND_SHIFT) == TRACE_FETCH ? isdist : dsdist, addr);
+    }
+}
+
+// Touch the L1 tag sets of a batch before walking it in order. The lookups
+// themselves stay sequential, so results match a plain loop.
+static void hierarchy_run(hierarchy_t *h, const uint64_t *rec, size_t n)
+{
+    for (size_t base = 0; base < n; base += BATCH) {
+        size_t end = base + BATCH < n ? base + BATCH : n;
+        for (size_t i = base; i < end; i++) {
+            const cache_t *c = hierarchy_l1(h, (int) (rec[i] >> TRACE_KIND_SHIFT));
+            uint64_t set = cache_addr_set(c, rec[i] & TRACE_ADDR_MASK);
+            __builtin_prefetch(&c->tags[set * c->way_stride]);
+        }
+        for (size_t i = base; i < end; i++) {
+            hierarchy_access(h, rec[i]);
+        }
+    }
+}
+
+static void hierarchy_print(FILE *out, int idx, const hierarchy_t *h)
+{
+    uint64_t total = h->accesses[TRACE_FETCH] + h->accesses[TRACE_READ] + h->accesses[TRACE_WRITE];
+    fprintf(out, "== hierarchy %d: %s\n", idx, h->spec);
+    fprintf(out, "fetches %" PRIu64 ", reads %" PRIu64 ", writes %" PRIu64
+            ", average miss penalty %.2f cycles per access\n",
+            h->accesses[TRACE_FETCH], h->accesses[TRACE_READ], h->accesses[TRACE_WRITE],
+            total ? (double) h->miss_cycles / total : 0.0);
+    cache_print_stats(out, h->l1i);
+    cache_print_stats(out, h->l1d);
+    cache_print_stats(out, h->l2);
+    cache_print_stats(out, h->l3);
+    cache_t *levels[] = { h->l1i, h->l1d, h->l2, h->l3 };
+    for (int i = 0; i < 4; i++) {
+        if (levels[i]) mclass_print_heatmap(out, levels[i]->name, levels[i]->mclass);
+    }
+    fprintf(out, "\n");
+}
+
+static void trace_open(trace_t *t, const char *path)
+{
+    memset(t, 0, sizeof(*t));
+    t->f = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+    if (!t->f) {
+        fprintf(stderr, "Cannot open trace %s\n", path);
+        exit(1);
+    }
+
+    // Regular files are mapped whole; pipes fall back to buffered reads
+    struct stat st;
+    if (fstat(fileno(t->f), &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size >= (off_t) sizeof(uint64_t)) {
+        void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno(t->f), 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+            t->map = (const uint64_t *) map;
+            t->map_len = (size_t) st.st_size;
+            t->count = (size_t) st.st_size / sizeof(uint64_t);
+            return;
+        }
+    }
+
+    t->buf = (uint64_t *) malloc(TRACE_CHUNK * sizeof(uint64_t));
+    if (!t->buf) {
+        fprintf(stderr, "Failed to allocate memory for trace buffer\n");
+        exit(1);
+    }
+}
+
+// Next run of records, 0 at the end of the trace
+static size_t trace_next(trace_t *t, const uint64_t **rec)
+{
+    if (t->map) {
+        size_t n = t->count - t->pos < TRACE_CHUNK ? t->count - t->pos : TRACE_CHUNK;
+        *rec = t->map + t->pos;
+        t->pos += n;
+        return n;
+    }
+    *rec = t->buf;
+    return fread(t->buf, sizeof(uint64_t), TRACE_CHUNK, t->f);
+}
+
+static void trace_close(trace_t *t)
+{
+    if (t->map) {
+        munmap((void *) t->map, t->map_len);
+    }
+    if (t->f != stdin) {
+        fclose(t->f);
+    }
+    free(t->buf);
+}
+
+// Build this worker's hierarchies (so their memory is allocated by the
+// thread that uses it), then run every chunk through them
+static void *worker_main(void *arg)
+{
+    worker_t *w = (worker_t *) arg;
+    for (int i = 0; i < w->count; i++) {
+        int idx = w->first + i * w->stride;
+        hierarchy_init(&w->h[idx], w->specs ? w->specs[idx] : NULL);
+    }
+    pthread_barrier_wait(&chunk_done);
+
+    for (;;) {
+        pthread_barrier_wait(&chunk_ready);
+        if (!chunk_len) break;
+        for (int i = 0; i < w->count; i++) {
+            hierarchy_run(&w->h[w->first + i * w->stride], chunk_rec, chunk_len);
+        }
+        pthread_barrier_wait(&chunk_done);
+    }
+    return NULL;
+}
+
+static void add_spec(const char **specs, int *num_specs, const char *spec)
+{
+    if (*num_specs == MAX_HIERARCHIES) {
+        fprintf(stderr, "At most %d hierarchies\n", MAX_HIERARCHIES);
+        exit(1);
+    }
+    specs[(*num_specs)++] = spec;
+}
+
+// One spec per line; blank lines and lines starting with # are skipped
+static void read_specs(const char *file, const char **specs, int *num_specs)
+{
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", file);
+        exit(1);
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, " \t\r\n")] = '\0';
+        if (line[0] && line[0] != '#') {
+            add_spec(specs, num_specs, strdup(line));
+        }
+    }
+    fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *specs[MAX_HIERARCHIES];
+    int num_specs = 0;
+    int threads = get_nprocs();
+    const char *path = NULL;
+    const char *curves = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-H")) {
+            if (++i == argc) usage(argv[0]);
+            add_spec(specs, &num_specs, argv[i]);
+        } else if (!strcmp(argv[i], "-f")) {
+            if (++i == argc) usage(argv[0]);
+            read_specs(argv[i], specs, &num_specs);
+        } else if (!strcmp(argv[i], "-j")) {
+            if (++i == argc) usage(argv[0]);
+            threads = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "-m")) {
+            classify = 1;
+        } else if (!strcmp(argv[i], "-c")) {
+            if (++i == argc) usage(argv[0]);
+            curves = argv[i];
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (!path) usage(argv[0]);
+
+    int num_h = num_specs ? num_specs : 1;
+    if (threads < 1) threads = 1;
+    if (threads > num_h) threads = num_h;
+
+    hierarchy_t *h = (hierarchy_t *) aligned_alloc(64, (size_t) num_h * sizeof(hierarchy_t));
+    worker_t *workers = (worker_t *) calloc((size_t) threads, sizeof(worker_t));
+    if (!h || !workers) {
+        fprintf(stderr, "Failed to allocate memory for hierarchies\n");
+        exit(1);
+    }
+    pthread_barrier_init(&chunk_ready, NULL, (unsigned) threads + 1);
+    pthread_barrier_init(&chunk_done, NULL, (unsigned) threads + 1);
+    for (int i = 0; i < threads; i++) {
+        workers[i].h = h;
+        workers[i].specs = num_specs ? specs : NULL;
+        workers[i].first = i;
+        workers[i].stride = threads;
+        workers[i].count = (num_h - i + threads - 1) / threads;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            fprintf(stderr, "Failed to start worker thread\n");
+            exit(1);
+        }
+    }
+    pthread_barrier_wait(&chunk_done);
+
+    sdist_t *isdist = NULL, *dsdist = NULL;
+    if (curves) {
+        isdist = sdist_new("I-side", hierarchy_l1(&h[0], TRACE_FETCH)->block_size);
+        dsdist = sdist_new("D-side", h[0].l1d->block_size);
+    }
+
+    trace_t t;
+    trace_open(&t, path);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The reader hands each chunk to every worker and profiles it meanwhile
+    uint64_t records = 0;
+    for (;;) {
+        chunk_len = trace_next(&t, &chunk_rec);
+        pthread_barrier_wait(&chunk_ready);
+        if (!chunk_len) break;
+        if (curves) {
+            profile_run(isdist, dsdist, chunk_rec, chunk_len);
+        }
+        records += chunk_len;
+        pthread_barrier_wait(&chunk_done);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    trace_close(&t);
+
+    for (int i = 0; i < num_h; i++) {
+        hierarchy_print(stdout, i, &h[i]);
+    }
+    if (curves) {
+        FILE *out = fopen(curves, "w");
+        if (!out) {
+            fprintf(stderr, "Cannot write %s\n", curves);
+            exit(1);
+        }
+        sdist_write_csv(out, isdist, 1);
+        sdist_write_csv(out, dsdist, 0);
+        fclose(out);
+        sdist_destroy(isdist);
+        sdist_destroy(dsdist);
+    }
+
+    double secs = (double) (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%" PRIu64 " records x %d hierarchies on %d threads in %.3f s (%.1f M accesses/s)\n",
+            records, num_h, threads, secs, secs > 0 ? records * num_h / secs / 1e6 : 0.0);
+    free(workers);
+    free(h);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "coherence.h"
+#include "cache.h"
+#include <stdlib.h>
+#include <inttypes.h>
+
+coh_bus_t *coh_new(int transfer_cycles)
+{
+    coh_bus_t *bus = (coh_bus_t *) calloc(1, sizeof(coh_bus_t));
+    if (!bus) {
+        fprintf(stderr, "Failed to allocate memory for coherence bus\n");
+        exit(1);
+    }
+    bus->transfer_cycles = transfer_cycles;
+    return bus;
+}
+
+void coh_destroy(coh_bus_t *bus)
+{
+    free(bus);
+}
+
+// Put c on the bus; every line starts Invalid
+void coh_attach(coh_bus_t *bus, cache_t *c)
+{
+    if (bus->num_caches == COH_MAX_CACHES) {
+        fprintf(stderr, "Too many caches on the coherence bus\n");
+        exit(1);
+    }
+    free(c->mesi);
+    c->mesi = (uint8_t *) calloc((size_t) c->num_sets * c->way_stride, sizeof(uint8_t));
+    if (!c->mesi) {
+        fprintf(stderr, "Failed to allocate coherence state for %s\n", c->name);
+        exit(1);
+    }
+    c->bus = bus;
+    c->bus_id = bus->num_caches;
+    bus->caches[bus->num_caches++] = c;
+}
+
+// Whether another cache holds addr Modified or Exclusive, and so would
+// supply it on a miss
+int coh_peer_owns(const coh_bus_t *bus, const cache_t *c, uint64_t addr)
+{
+    for (int i = 0; i < bus->num_caches; i++) {
+        cache_t *peer = bus->caches[i];
+        if (peer == c) continue;
+        int line = cache_line_index(peer, addr);
+        if (line >= 0 && peer->mesi[line] >= MESI_E) return 1;
+    }
+    return 0;
+}
+
+// c has just filled addr into line: snoop the peers and pick its state
+void coh_fill(coh_bus_t *bus, cache_t *c, uint64_t addr, int line)
+{
+    int shared = 0;
+    bus->stat_reads++;
+    for (int i = 0; i < bus->num_caches; i++) {
+        cache_t *peer = bus->caches[i];
+        if (peer == c) continue;
+        int peer_line = cache_line_index(peer, addr);
+        if (peer_line < 0) continue;
+        shared = 1;
+        if (peer->mesi[peer_line] == MESI_M && peer->dirty[peer_line]) {
+            bus->stat_flushes++;
+        }
+        if (peer->mesi[peer_line] >= MESI_E) {
+            bus->stat_interventions++;
+            // A core on another thread gives the block up at its next cycle
+            if (peer->inbox) {
+                cache_post(peer, CACHE_MSG_SHARE, addr);
+            } else {
+                coh_share(peer, addr);
+            }
+        }
+    }
+    c->mesi[line] = shared ? MESI_S : MESI_E;
+}
+
+// c is about to store to addr: gain ownership, invalidating other copies
+void coh_write(coh_bus_t *bus, cache_t *c, uint64_t addr)
+{
+    int line = cache_line_index(c, addr);
+    if (line >= 0 && c->mesi[line] != MESI_S) {
+        c->mesi[line] = MESI_M;
+        return;
+    }
+
+    if (line >= 0) {
+        bus->stat_upgrades++;
+    } else {
+        bus->stat_write_invalidates++;
+    }
+    for (int i = 0; i < bus->num_caches; i++) {
+        cache_t *peer = bus->caches[i];
+        if (peer == c) continue;
+        int held = peer->inbox ? cache_post(peer, CACHE_MSG_INVALIDATE, addr)
+                               : cache_invalidate(peer, addr);
+        if (held) {
+            bus->stat_invalidations++;
+            bus->stat_invalidated[i]++;
+        }
+    }
+    if (line >= 0) {
+        c->mesi[line] = MESI_M;
+    }
+}
+
+// c gives up ownership of addr: a dirty copy is written back and the line
+// stays Shared
+void coh_share(cache_t *c, uint64_t addr)
+{
+    int line = cache_line_index(c, addr);
+    if (line < 0 || c->mesi[line] < MESI_E) return;
+    cache_clean(c, addr);
+    c->mesi[line] = MESI_S;
+}
+
+void coh_print_stats(FILE *out, const coh_bus_t *bus)
+{
+    if (!bus) return;
+    fprintf(out, "Coherence: MESI snooping bus, %d caches, peer transfer %d cycles\n",
+            bus->num_caches, bus->transfer_cycles);
+    fprintf(out, "  fills %" PRIu64 ", interventions %" PRIu64 " (%" PRIu64 " flushes), upgrades %"
+            PRIu64 ", write-invalidates %" PRIu64 "\n",
+            bus->stat_reads, bus->stat_interventions, bus->stat_flushes,
+            bus->stat_upgrades, bus->stat_write_invalidates);
+    fprintf(out, "  invalidations %" PRIu64 ":", bus->stat_invalidations);
+    for (int i = 0; i < bus->num_caches; i++) {
+        fprintf(out, " core %d lost %" PRIu64, i, bus->stat_invalidated[i]);
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,56 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * MESI snooping bus between the private L1D caches of a multicore. Each
+ * line of a coherent cache carries a MESI state. A fill snoops the other
+ * caches: Modified or Exclusive copies drop to Shared (a Modified one is
+ * written back first) and supply the block; the new line is Exclusive if
+ * no one else holds the block, Shared otherwise. A store to a Shared line
+ * invalidates every other copy and makes the line Modified; Exclusive lines
+ * become Modified silently. Guest memory itself is shared by all cores, so
+ * the protocol only decides timing and traffic.
+ */
+#ifndef _COHERENCE_H_
+#define _COHERENCE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct cache;
+
+#define COH_MAX_CACHES 8
+
+typedef enum {
+    MESI_I = 0,
+    MESI_S,
+    MESI_E,
+    MESI_M
+} mesi_state_t;
+
+typedef struct coh_bus {
+    struct cache *caches[COH_MAX_CACHES];
+    int num_caches;
+    int transfer_cycles;            /* miss latency when a peer supplies the block */
+
+    /* statistics */
+    uint64_t stat_reads;            /* fills that snooped the bus */
+    uint64_t stat_upgrades;         /* stores to Shared lines */
+    uint64_t stat_write_invalidates; /* stores to blocks the writer does not hold */
+    uint64_t stat_interventions;    /* fills supplied by a Modified or Exclusive peer */
+    uint64_t stat_flushes;          /* Modified copies written back on a snoop */
+    uint64_t stat_invalidations;    /* lines invalidated in other caches */
+    uint64_t stat_invalidated[COH_MAX_CACHES]; /* lines each cache lost */
+} coh_bus_t;
+
+coh_bus_t *coh_new(int transfer_cycles);
+void coh_destroy(coh_bus_t *bus);
+void coh_attach(coh_bus_t *bus, struct cache *c);
+int coh_peer_owns(const coh_bus_t *bus, const struct cache *c, uint64_t addr);
+void coh_fill(coh_bus_t *bus, struct cache *c, uint64_t addr, int line);
+void coh_write(coh_bus_t *bus, struct cache *c, uint64_t addr);
+void coh_share(struct cache *c, uint64_t addr);
+void coh_print_stats(FILE *out, const coh_bus_t *bus);
+
+#endif
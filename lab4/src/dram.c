@@ -0,0 +1,265 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "dram.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+static int dram_log2(int x)
+{
+    int bits = 0;
+    while ((1 << bits) < x) bits++;
+    return bits;
+}
+
+static int is_pow2(int x)
+{
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+dram_t *dram_new(int channels, int ranks, int banks, int row_size)
+{
+    if (!is_pow2(channels) || !is_pow2(ranks) || !is_pow2(banks) ||
+        channels > DRAM_MAX_CHANNELS || channels * ranks * banks > DRAM_MAX_BANKS) {
+        fprintf(stderr, "Unsupported DRAM geometry: %d channels x %d ranks x %d banks "
+                "(powers of two, at most %d banks)\n", channels, ranks, banks, DRAM_MAX_BANKS);
+        exit(1);
+    }
+    if (!is_pow2(row_size) || row_size < DRAM_BUS_BYTES) {
+        fprintf(stderr, "Unsupported DRAM row size: %d\n", row_size);
+        exit(1);
+    }
+
+    dram_t *d = (dram_t *) calloc(1, sizeof(dram_t));
+    if (!d) {
+        fprintf(stderr, "Failed to allocate memory for DRAM\n");
+        exit(1);
+    }
+    d->channels = channels;
+    d->ranks = ranks;
+    d->banks = banks;
+    d->row_size = row_size;
+    d->column_bits = dram_log2(row_size);
+    d->channel_bits = dram_log2(channels);
+    d->bank_bits = dram_log2(banks);
+    d->rank_bits = dram_log2(ranks);
+    d->page_policy = DRAM_OPEN_PAGE;
+    d->scheduler = DRAM_FR_FCFS;
+    d->tRCD = 15;
+    d->tRP = 15;
+    d->tCAS = 15;
+    d->tBURST = 4;
+    d->ctrl_cycles = 10;
+    for (int i = 0; i < DRAM_MAX_BANKS; i++) {
+        d->bank[i].open_row = -1;
+    }
+    return d;
+}
+
+void dram_destroy(dram_t *d)
+{
+    free(d);
+}
+
+void dram_copy(dram_t *dst, const dram_t *src)
+{
+    if (!dst || !src) return;
+    *dst = *src;
+}
+
+dram_t *dram_clone(const dram_t *src)
+{
+    if (!src) return NULL;
+    dram_t *d = dram_new(src->channels, src->ranks, src->banks, src->row_size);
+    dram_copy(d, src);
+    return d;
+}
+
+// Address layout, low to high: column | channel | bank | rank | row, so a
+// sequential stream stays in one row and neighbouring rows spread out
+static dram_bank_t *dram_bank_of(dram_t *d, uint64_t addr, int *channel, int64_t *row)
+{
+    uint64_t a = addr >> d->column_bits;
+    *channel = (int) (a & (uint64_t) (d->channels - 1));
+    a >>= d->channel_bits;
+    int bank = (int) (a & (uint64_t) (d->banks - 1));
+    a >>= d->bank_bits;
+    int rank = (int) (a & (uint64_t) (d->ranks - 1));
+    *row = (int64_t) (a >> d->rank_bits);
+    return &d->bank[(*channel * d->ranks + rank) * d->banks + bank];
+}
+
+// Issue an access no earlier than cycle at; returns the cycle its last byte
+// leaves the data bus
+static uint64_t dram_issue(dram_t *d, uint64_t addr, int bytes, uint64_t at)
+{
+    int channel;
+    int64_t row;
+    dram_bank_t *b = dram_bank_of(d, addr, &channel, &row);
+
+    uint64_t start = b->ready > at ? b->ready : at;
+    int command;
+    if (b->open_row == row) {
+        command = d->tCAS;
+        d->stat_row_hits++;
+    } else if (b->open_row < 0) {
+        command = d->tRCD + d->tCAS;
+        d->stat_row_empty++;
+    } else {
+        command = d->tRP + d->tRCD + d->tCAS;
+        d->stat_row_conflicts++;
+    }
+
+    int burst = d->tBURST * ((bytes + DRAM_BUS_BYTES - 1) / DRAM_BUS_BYTES);
+    uint64_t data = start + command;
+    if (data < d->bus_free[channel]) data = d->bus_free[channel];
+    uint64_t done = data + burst;
+    d->bus_free[channel] = done;
+    d->stat_bus_busy += burst;
+    d->stat_bytes += bytes;
+
+    if (d->page_policy == DRAM_CLOSED_PAGE) {
+        b->open_row = -1;
+        b->ready = done + d->tRP;
+    } else {
+        b->open_row = row;
+        b->ready = done;
+    }
+    return done;
+}
+
+static int dram_write_find(const dram_t *d, uint64_t addr)
+{
+    for (int i = 0; i < DRAM_WRITE_QUEUE; i++) {
+        if (d->write_queue[i].valid && d->write_queue[i].addr == addr) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Choose the queued write to issue next, or -1. FCFS only ever considers the
+// oldest write; FR-FCFS takes the oldest row hit, else the oldest write.
+// With idle_only, writes to a busy bank are not eligible.
+static int dram_pick_write(dram_t *d, int idle_only)
+{
+    int oldest = -1, oldest_hit = -1;
+    for (int i = 0; i < DRAM_WRITE_QUEUE; i++) {
+        dram_write_t *w = &d->write_queue[i];
+        if (!w->valid) continue;
+        if (d->scheduler == DRAM_FCFS) {
+            if (oldest < 0 || w->arrival < d->write_queue[oldest].arrival) oldest = i;
+            continue;
+        }
+
+        int channel;
+        int64_t row;
+        dram_bank_t *b = dram_bank_of(d, w->addr, &channel, &row);
+        if (idle_only && b->ready > d->now) continue;
+        if (oldest < 0 || w->arrival < d->write_queue[oldest].arrival) oldest = i;
+        if (b->open_row == row &&
+            (oldest_hit < 0 || w->arrival < d->write_queue[oldest_hit].arrival)) {
+            oldest_hit = i;
+        }
+    }
+
+    if (d->scheduler == DRAM_FCFS && oldest >= 0 && idle_only) {
+        int channel;
+        int64_t row;
+        if (dram_bank_of(d, d->write_queue[oldest].addr, &channel, &row)->ready > d->now) {
+            return -1;
+        }
+    }
+    return oldest_hit >= 0 ? oldest_hit : oldest;
+}
+
+static void dram_issue_write(dram_t *d, int idx)
+{
+    dram_write_t *w = &d->write_queue[idx];
+    dram_issue(d, w->addr, DRAM_BUS_BYTES, d->now);
+    d->stat_writes++;
+    w->valid = 0;
+}
+
+// Cycles until a block read arrives back at the cache
+int dram_read(dram_t *d, uint64_t addr, int bytes)
+{
+    d->stat_reads++;
+
+    // The newest copy may still be waiting in the write queue
+    if (dram_write_find(d, addr & ~(uint64_t) (DRAM_BUS_BYTES - 1)) >= 0) {
+        d->stat_forwarded++;
+        d->stat_read_cycles += 2 * d->ctrl_cycles;
+        return 2 * d->ctrl_cycles;
+    }
+
+    uint64_t done = dram_issue(d, addr, bytes, d->now + d->ctrl_cycles);
+    int latency = (int) (done - d->now) + d->ctrl_cycles;
+    d->stat_read_cycles += latency;
+    return latency;
+}
+
+// Post a write; it is issued later by dram_tick(), or right away if the
+// queue has no room
+void dram_write(dram_t *d, uint64_t addr, int bytes)
+{
+    if (!d) return;
+
+    uint64_t first = addr & ~(uint64_t) (DRAM_BUS_BYTES - 1);
+    for (uint64_t line = first; line < addr + (uint64_t) bytes; line += DRAM_BUS_BYTES) {
+        // Writes to a burst already queued merge into it
+        if (dram_write_find(d, line) >= 0) continue;
+
+        int slot = -1;
+        for (int i = 0; i < DRAM_WRITE_QUEUE; i++) {
+            if (!d->write_queue[i].valid) { slot = i; break; }
+        }
+        if (slot < 0) {
+            d->stat_forced_drains++;
+            slot = dram_pick_write(d, 0);
+            dram_issue_write(d, slot);
+        }
+        d->write_queue[slot].valid = 1;
+        d->write_queue[slot].addr = line;
+        d->write_queue[slot].arrival = d->now;
+    }
+}
+
+// Advance the clock; an idle bank takes the next queued write
+void dram_tick(dram_t *d)
+{
+    if (!d) return;
+    d->now++;
+    int idx = dram_pick_write(d, 1);
+    if (idx >= 0) {
+        dram_issue_write(d, idx);
+    }
+}
+
+void dram_print_stats(FILE *out, const dram_t *d)
+{
+    if (!d) return;
+    uint64_t accesses = d->stat_row_hits + d->stat_row_empty + d->stat_row_conflicts;
+    fprintf(out, "DRAM: %d channels x %d ranks x %d banks, %d B rows, %s, %s\n",
+            d->channels, d->ranks, d->banks, d->row_size,
+            d->page_policy == DRAM_CLOSED_PAGE ? "closed-page" : "open-page",
+            d->scheduler == DRAM_FR_FCFS ? "FR-FCFS" : "FCFS");
+    fprintf(out, "  tRCD %d, tRP %d, tCAS %d, tBURST %d, controller %d cycles\n",
+            d->tRCD, d->tRP, d->tCAS, d->tBURST, d->ctrl_cycles);
+    fprintf(out, "  reads %" PRIu64 " (%" PRIu64 " from the write queue), writes %" PRIu64
+            " (%" PRIu64 " forced drains), average read latency %.1f cycles\n",
+            d->stat_reads, d->stat_forwarded, d->stat_writes, d->stat_forced_drains,
+            d->stat_reads ? (double) d->stat_read_cycles / d->stat_reads : 0.0);
+    fprintf(out, "  row hits %" PRIu64 ", empty %" PRIu64 ", conflicts %" PRIu64
+            ", row hit rate %.2f%%\n",
+            d->stat_row_hits, d->stat_row_empty, d->stat_row_conflicts,
+            accesses ? 100.0 * d->stat_row_hits / accesses : 0.0);
+    fprintf(out, "  bytes %" PRIu64 ", bandwidth %.2f B/cycle, bus utilization %.2f%%\n",
+            d->stat_bytes, d->now ? (double) d->stat_bytes / d->now : 0.0,
+            d->now ? 100.0 * d->stat_bus_busy / ((double) d->now * d->channels) : 0.0);
+}
@@ -0,0 +1,82 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * DRAM behind the last cache level. Memory is split into channels, ranks
+ * and banks, each bank holding one open row. A request pays tCAS on a row
+ * hit, tRCD + tCAS on a closed bank and tRP + tRCD + tCAS on a row conflict,
+ * then waits for its channel's data bus. Reads are timed when they arrive,
+ * since the caches need their latency at once; writes are posted to a queue
+ * and drained into idle banks by the scheduler. All state lives in fixed-size
+ * arrays so the model can be copied into a snapshot.
+ */
+#ifndef _DRAM_H_
+#define _DRAM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    DRAM_OPEN_PAGE = 0,   /* rows stay open until a conflict */
+    DRAM_CLOSED_PAGE      /* rows are precharged after every access */
+} dram_page_policy_t;
+
+typedef enum {
+    DRAM_FCFS = 0,        /* queued writes leave strictly in arrival order */
+    DRAM_FR_FCFS          /* row hits first, then the oldest request */
+} dram_scheduler_t;
+
+#define DRAM_MAX_CHANNELS 8
+#define DRAM_MAX_BANKS    64     /* channels x ranks x banks */
+#define DRAM_WRITE_QUEUE  16
+#define DRAM_BUS_BYTES    64     /* bytes moved per tBURST */
+
+typedef struct dram_bank {
+    int64_t open_row;            /* -1 when precharged */
+    uint64_t ready;              /* cycle the bank can take a new command */
+} dram_bank_t;
+
+typedef struct dram_write {
+    int valid;
+    uint64_t addr;               /* DRAM_BUS_BYTES aligned */
+    uint64_t arrival;
+} dram_write_t;
+
+typedef struct dram {
+    int channels, ranks, banks;
+    int row_size;                /* bytes per row */
+    int column_bits, channel_bits, bank_bits, rank_bits;
+    dram_page_policy_t page_policy;
+    dram_scheduler_t scheduler;
+    int tRCD, tRP, tCAS, tBURST;
+    int ctrl_cycles;             /* controller and interconnect, each way */
+
+    dram_bank_t bank[DRAM_MAX_BANKS];
+    uint64_t bus_free[DRAM_MAX_CHANNELS];
+    dram_write_t write_queue[DRAM_WRITE_QUEUE];
+    uint64_t now;
+
+    /* statistics */
+    uint64_t stat_reads;
+    uint64_t stat_writes;
+    uint64_t stat_row_hits;
+    uint64_t stat_row_empty;
+    uint64_t stat_row_conflicts;
+    uint64_t stat_forwarded;     /* reads served from the write queue */
+    uint64_t stat_forced_drains; /* writes issued because the queue was full */
+    uint64_t stat_read_cycles;   /* total read latency */
+    uint64_t stat_bytes;
+    uint64_t stat_bus_busy;      /* data bus cycles, summed over channels */
+} dram_t;
+
+dram_t *dram_new(int channels, int ranks, int banks, int row_size);
+void dram_destroy(dram_t *d);
+void dram_copy(dram_t *dst, const dram_t *src);
+dram_t *dram_clone(const dram_t *src);
+int dram_read(dram_t *d, uint64_t addr, int bytes);
+void dram_write(dram_t *d, uint64_t addr, int bytes);
+void dram_tick(dram_t *d);
+void dram_print_stats(FILE *out, const dram_t *d);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "fillbuf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+void fillbuf_init(fillbuf_t *f, int word_size, int beat_cycles)
+{
+    if (word_size <= 0 || (word_size & (word_size - 1)) || beat_cycles < 0) {
+        fprintf(stderr, "Unsupported fill buffer: %d-byte words every %d cycles\n",
+                word_size, beat_cycles);
+        exit(1);
+    }
+    memset(f, 0, sizeof(*f));
+    f->word_size = word_size;
+    f->beat_cycles = beat_cycles;
+}
+
+static int fillbuf_words(const fillbuf_t *f, const cache_t *c)
+{
+    return c->sector_size > f->word_size ? c->sector_size / f->word_size : 1;
+}
+
+static int fillbuf_word(const fillbuf_t *f, const cache_t *c, uint64_t addr)
+{
+    return (int) ((addr & (uint64_t) (c->sector_size - 1)) / (uint64_t) f->word_size) %
+           fillbuf_words(f, c);
+}
+
+// Cycles from the start of the fill until word arrives
+static int fillbuf_arrival(const fillbuf_t *f, const cache_t *c, int word)
+{
+    int n = fillbuf_words(f, c);
+    int later = (word - f->critical + n) % n;
+    int t = f->first + later * f->beat_cycles;
+    return t < f->total ? t : f->total;
+}
+
+static void fillbuf_install(fillbuf_t *f, cache_t *c)
+{
+    cache_insert(c, f->block_addr);
+    f->active = 0;
+}
+
+// Cycles from the start of the fill until the bytes at addr are all in; a
+// whole-block access waits for the line itself
+static int fillbuf_ready(const fillbuf_t *f, const cache_t *c, uint64_t addr, int bytes)
+{
+    if (bytes >= c->sector_size) {
+        return f->total;
+    }
+    uint64_t offset = addr & (uint64_t) (c->sector_size - 1);
+    if (offset + (uint64_t) bytes > (uint64_t) c->sector_size) {
+        bytes = c->sector_size - (int) offset;
+    }
+    int ready = 0;
+    for (int w = fillbuf_word(f, c, addr); w <= fillbuf_word(f, c, addr + bytes - 1); w++) {
+        int t = fillbuf_arrival(f, c, w);
+        if (t > ready) ready = t;
+    }
+    return ready;
+}
+
+// Start filling addr's block, which arrives latency cycles after a delay
+// (a page walk, say), and return the cycles until the bytes at addr are
+// in. A fill still streaming in is installed at once, since there is one
+// buffer per cache.
+int fillbuf_start(fillbuf_t *f, cache_t *c, uint64_t addr, int bytes, int delay, int latency)
+{
+    if (f->active) {
+        f->stat_cut_short++;
+        fillbuf_install(f, c);
+    }
+    int stream = (fillbuf_words(f, c) - 1) * f->beat_cycles;
+    f->active = 1;
+    f->block_addr = addr & ~((uint64_t) c->sector_size - 1);
+    f->critical = fillbuf_word(f, c, addr);
+    f->first = latency - stream > 1 ? latency - stream : 1;
+    f->total = latency > f->first ? latency : f->first;
+    f->elapsed = -delay;
+
+    f->stat_fills++;
+    f->stat_first_sum += (uint64_t) f->first;
+    f->stat_total_sum += (uint64_t) f->total;
+    return delay + fillbuf_ready(f, c, addr, bytes);
+}
+
+// Whether addr's block is streaming into the buffer
+int fillbuf_holds(const fillbuf_t *f, const cache_t *c, uint64_t addr)
+{
+    return f->active && (addr & ~((uint64_t) c->sector_size - 1)) == f->block_addr;
+}
+
+// For an access of bytes at addr: -1 if its block is not being filled, else
+// the cycles until the last of its bytes is in (0 = it can be served from
+// the buffer now)
+int fillbuf_wait(fillbuf_t *f, const cache_t *c, uint64_t addr, int bytes)
+{
+    if (!fillbuf_holds(f, c, addr)) {
+        return -1;
+    }
+    int ready = fillbuf_ready(f, c, addr, bytes);
+    int wait = ready > f->elapsed ? ready - f->elapsed : 0;
+    if (wait) {
+        f->stat_waits++;
+        f->stat_wait_cycles += (uint64_t) wait;
+    } else {
+        f->stat_early++;
+    }
+    return wait;
+}
+
+// One cycle of the fill; the block goes into c once its last word is in
+void fillbuf_tick(fillbuf_t *f, cache_t *c)
+{
+    if (!f->active) return;
+    if (++f->elapsed >= f->total) {
+        fillbuf_install(f, c);
+    }
+}
+
+void fillbuf_print_stats(FILE *out, const char *name, const fillbuf_t *f)
+{
+    if (f->beat_cycles == 0) return;
+    fprintf(out, "%s fill buffer: critical word first, %d-byte words every %d cycles\n",
+            name, f->word_size, f->beat_cycles);
+    fprintf(out, "  fills %" PRIu64 ", average cycles to critical word %.2f, to whole block %.2f\n",
+            f->stat_fills,
+            f->stat_fills ? (double) f->stat_first_sum / f->stat_fills : 0.0,
+            f->stat_fills ? (double) f->stat_total_sum / f->stat_fills : 0.0);
+    fprintf(out, "  served from buffer %" PRIu64 ", waited on a word %" PRIu64 " (%" PRIu64
+            " cycles), cut short by the next miss %" PRIu64 "\n",
+            f->stat_early, f->stat_waits, f->stat_wait_cycles, f->stat_cut_short);
+}
@@ -0,0 +1,48 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Fill buffer for critical-word-first line fills. A miss asks for the
+ * missing word first; the rest of the block follows in wrap-around order,
+ * a bus word per beat, and the whole block arrives when the plain fill
+ * would have. The block sits in the fill buffer meanwhile: accesses to
+ * words that have arrived are served from it, accesses to words still on
+ * their way wait only for them, and the line is installed in the cache
+ * once the last word is in.
+ */
+#ifndef _FILLBUF_H_
+#define _FILLBUF_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "cache.h"
+
+typedef struct fillbuf {
+    int word_size;           /* bytes per beat */
+    int beat_cycles;         /* cycles between words, 0 = whole-block fills */
+    int active;
+    uint64_t block_addr;
+    int critical;            /* word asked for first */
+    int first;               /* cycles from the miss to the critical word */
+    int total;               /* cycles from the miss to the whole block */
+    int elapsed;             /* negative while the fill waits to start */
+
+    /* statistics */
+    uint64_t stat_fills;
+    uint64_t stat_first_sum;       /* cycles to the critical word, summed */
+    uint64_t stat_total_sum;       /* cycles to the whole block, summed */
+    uint64_t stat_early;           /* accesses served before the line was installed */
+    uint64_t stat_waits;           /* accesses that waited for a word in flight */
+    uint64_t stat_wait_cycles;
+    uint64_t stat_cut_short;       /* fills installed early by the next miss */
+} fillbuf_t;
+
+void fillbuf_init(fillbuf_t *f, int word_size, int beat_cycles);
+int fillbuf_start(fillbuf_t *f, cache_t *c, uint64_t addr, int bytes, int delay, int latency);
+int fillbuf_holds(const fillbuf_t *f, const cache_t *c, uint64_t addr);
+int fillbuf_wait(fillbuf_t *f, const cache_t *c, uint64_t addr, int bytes);
+void fillbuf_tick(fillbuf_t *f, cache_t *c);
+void fillbuf_print_stats(FILE *out, const char *name, const fillbuf_t *f);
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "mclass.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define MCLASS_MIN_SEEN (1 << 12)
+#define MCLASS_HOT_SETS 8
+
+static void *mclass_alloc(size_t bytes)
+{
+    void *p = calloc(1, bytes);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate memory for miss classification\n");
+        exit(1);
+    }
+    return p;
+}
+
+mclass_t *mclass_new(int sets, int ways, int block_size)
+{
+    mclass_t *m = (mclass_t *) mclass_alloc(sizeof(mclass_t));
+    m->num_sets = sets;
+    while ((1 << m->block_bits) < block_size) m->block_bits++;
+
+    m->capacity = sets * ways;
+    m->blocks = (uint64_t *) mclass_alloc((size_t) m->capacity * sizeof(uint64_t));
+    m->prev = (int32_t *) mclass_alloc((size_t) m->capacity * sizeof(int32_t));
+    m->next = (int32_t *) mclass_alloc((size_t) m->capacity * sizeof(int32_t));
+    m->head = m->tail = -1;
+    m->index_size = 4;
+    while (m->index_size < 2 * (size_t) m->capacity) m->index_size *= 2;
+    m->index = (int32_t *) mclass_alloc(m->index_size * sizeof(int32_t));
+
+    m->seen_size = MCLASS_MIN_SEEN;
+    m->seen = (uint64_t *) mclass_alloc(m->seen_size * sizeof(uint64_t));
+    m->set_conflicts = (uint64_t *) mclass_alloc((size_t) sets * sizeof(uint64_t));
+    return m;
+}
+
+void mclass_destroy(mclass_t *m)
+{
+    if (!m) return;
+    free(m->blocks);
+    free(m->prev);
+    free(m->next);
+    free(m->index);
+    free(m->seen);
+    free(m->set_conflicts);
+    free(m);
+}
+
+// Copy the shadow, the seen set and the statistics; both sides must share
+// a geometry, but dst's seen set is resized to match src
+void mclass_copy(mclass_t *dst, const mclass_t *src)
+{
+    if (!dst || !src) return;
+    memcpy(dst->blocks, src->blocks, (size_t) src->capacity * sizeof(uint64_t));
+    memcpy(dst->prev, src->prev, (size_t) src->capacity * sizeof(int32_t));
+    memcpy(dst->next, src->next, (size_t) src->capacity * sizeof(int32_t));
+    memcpy(dst->index, src->index, src->index_size * sizeof(int32_t));
+    memcpy(dst->set_conflicts, src->set_conflicts, (size_t) src->num_sets * sizeof(uint64_t));
+    if (dst->seen_size != src->seen_size) {
+        free(dst->seen);
+        dst->seen = (uint64_t *) mclass_alloc(src->seen_size * sizeof(uint64_t));
+    }
+    memcpy(dst->seen, src->seen, src->seen_size * sizeof(uint64_t));
+    dst->seen_size = src->seen_size;
+    dst->seen_used = src->seen_used;
+    dst->head = src->head;
+    dst->tail = src->tail;
+    dst->used = src->used;
+    dst->stat_compulsory = src->stat_compulsory;
+    dst->stat_capacity = src->stat_capacity;
+    dst->stat_conflict = src->stat_conflict;
+    dst->stat_sector = src->stat_sector;
+}
+
+mclass_t *mclass_clone(const mclass_t *src)
+{
+    if (!src) return NULL;
+    mclass_t *m = mclass_new(src->num_sets, src->capacity / src->num_sets, 1 << src->block_bits);
+    mclass_copy(m, src);
+    return m;
+}
+
+static size_t mclass_hash(uint64_t block, size_t mask)
+{
+    return (size_t) ((block * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+/************************** seen set **************************/
+
+static size_t mclass_seen_slot(const mclass_t *m, uint64_t block)
+{
+    size_t mask = m->seen_size - 1;
+    size_t i = mclass_hash(block, mask);
+    while (m->seen[i] && m->seen[i] != block + 1) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Record block; returns 1 if it had not been seen before
+static int mclass_seen_insert(mclass_t *m, uint64_t block)
+{
+    size_t slot = mclass_seen_slot(m, block);
+    if (m->seen[slot]) return 0;
+    m->seen[slot] = block + 1;
+    m->seen_used++;
+
+    if (m->seen_used * 2 > m->seen_size) {
+        uint64_t *old = m->seen;
+        size_t old_size = m->seen_size;
+        m->seen_size *= 2;
+        m->seen = (uint64_t *) mclass_alloc(m->seen_size * sizeof(uint64_t));
+        for (size_t i = 0; i < old_size; i++) {
+            if (old[i]) m->seen[mclass_seen_slot(m, old[i] - 1)] = old[i];
+        }
+        free(old);
+    }
+    return 1;
+}
+
+/************************ shadow cache ************************/
+
+// Slot of block in the shadow's index, or the empty slot where it belongs
+static size_t mclass_index_slot(const mclass_t *m, uint64_t block)
+{
+    size_t mask = m->index_size - 1;
+    size_t i = mclass_hash(block, mask);
+    while (m->index[i] && m->blocks[m->index[i] - 1] != block + 1) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Empty slot i, pulling later entries of the probe run back over it
+static void mclass_index_remove(mclass_t *m, size_t i)
+{
+    size_t mask = m->index_size - 1;
+    for (size_t j = (i + 1) & mask; m->index[j]; j = (j + 1) & mask) {
+        size_t home = mclass_hash(m->blocks[m->index[j] - 1] - 1, mask);
+        // Entry j may move to i only if its home is not in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            m->index[i] = m->index[j];
+            i = j;
+        }
+    }
+    m->index[i] = 0;
+}
+
+static void mclass_unlink(mclass_t *m, int32_t n)
+{
+    if (m->prev[n] >= 0) m->next[m->prev[n]] = m->next[n];
+    else m->head = m->next[n];
+    if (m->next[n] >= 0) m->prev[m->next[n]] = m->prev[n];
+    else m->tail = m->prev[n];
+}
+
+static void mclass_push_front(mclass_t *m, int32_t n)
+{
+    m->prev[n] = -1;
+    m->next[n] = m->head;
+    if (m->head >= 0) m->prev[m->head] = n;
+    else m->tail = n;
+    m->head = n;
+}
+
+// Classify the access if the real cache missed, then play it on the shadow;
+// set is where the real cache looked for the block. The shadow works in
+// whole blocks, so to it a sector miss is a hit.
+void mclass_access(mclass_t *m, uint64_t addr, int set, mclass_outcome_t outcome)
+{
+    if (!m) return;
+    uint64_t block = addr >> m->block_bits;
+    size_t slot = mclass_index_slot(m, block);
+    int shadow_hit = m->index[slot] != 0;
+
+    // A shadow hit means the block was seen; a real hit on a block never
+    // seen (a prefetched line) still has to be recorded
+    int first = !shadow_hit && mclass_seen_insert(m, block);
+    if (outcome == MCLASS_SECTOR_MISS) {
+        m->stat_sector++;
+    } else if (outcome == MCLASS_MISS) {
+        if (first) {
+            m->stat_compulsory++;
+        } else if (shadow_hit) {
+            m->stat_conflict++;
+            m->set_conflicts[set]++;
+        } else {
+            m->stat_capacity++;
+        }
+    }
+
+    if (shadow_hit) {
+        int32_t n = m->index[slot] - 1;
+        if (m->head != n) {
+            mclass_unlink(m, n);
+            mclass_push_front(m, n);
+        }
+        return;
+    }
+
+    int32_t n;
+    if (m->used < m->capacity) {
+        n = m->used++;
+    } else {
+        n = m->tail;
+        mclass_index_remove(m, mclass_index_slot(m, m->blocks[n] - 1));
+        mclass_unlink(m, n);
+        slot = mclass_index_slot(m, block);
+    }
+    m->blocks[n] = block + 1;
+    m->index[slot] = n + 1;
+    mclass_push_front(m, n);
+}
+
+void mclass_print_stats(FILE *out, const mclass_t *m)
+{
+    if (!m) return;
+    uint64_t misses = m->stat_compulsory + m->stat_capacity + m->stat_conflict + m->stat_sector;
+    fprintf(out, "  misses: compulsory %" PRIu64 " (%.2f%%), capacity %" PRIu64
+            " (%.2f%%), conflict %" PRIu64 " (%.2f%%)",
+            m->stat_compulsory, misses ? 100.0 * m->stat_compulsory / misses : 0.0,
+            m->stat_capacity, misses ? 100.0 * m->stat_capacity / misses : 0.0,
+            m->stat_conflict, misses ? 100.0 * m->stat_conflict / misses : 0.0);
+    if (m->stat_sector) {
+        fprintf(out, ", sector %" PRIu64 " (%.2f%%)",
+                m->stat_sector, 100.0 * m->stat_sector / misses);
+    }
+    fprintf(out, "\n");
+}
+
+static int mclass_count_desc(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// One character per set, 64 sets per row, scaled to the hottest set;
+// then the hottest sets by count
+void mclass_print_heatmap(FILE *out, const char *name, const mclass_t *m)
+{
+    static const char shades[] = " .:-=+*#%@";
+
+    if (!m) return;
+    uint64_t max = 0;
+    for (int s = 0; s < m->num_sets; s++) {
+        if (m->set_conflicts[s] > max) max = m->set_conflicts[s];
+    }
+    fprintf(out, "%s conflict misses per set: %" PRIu64 " total, %d sets, at most %" PRIu64
+            " in one set\n", name, m->stat_conflict, m->num_sets, max);
+    if (!max) return;
+
+    // How evenly they spread: sets that see any, the share of the hottest
+    // tenth of the sets, and the hottest set against the mean
+    uint64_t *sorted = (uint64_t *) mclass_alloc((size_t) m->num_sets * sizeof(uint64_t));
+    memcpy(sorted, m->set_conflicts, (size_t) m->num_sets * sizeof(uint64_t));
+    qsort(sorted, (size_t) m->num_sets, sizeof(uint64_t), mclass_count_desc);
+    int tenth = (m->num_sets + 9) / 10, used = 0;
+    uint64_t top = 0;
+    for (int s = 0; s < m->num_sets; s++) {
+        used += sorted[s] != 0;
+        if (s < tenth) top += sorted[s];
+    }
+    free(sorted);
+    fprintf(out, "  spread: %d sets see conflicts, the hottest 10%% of sets take %.1f%%,"
+            " hottest set %.1fx the mean\n", used, 100.0 * top / m->stat_conflict,
+            (double) max * m->num_sets / m->stat_conflict);
+
+    for (int row = 0; row < m->num_sets; row += 64) {
+        fprintf(out, "  %5d |", row);
+        for (int s = row; s < row + 64 && s < m->num_sets; s++) {
+            uint64_t count = m->set_conflicts[s];
+            fputc(shades[count ? 1 + (count * 9 - 1) / max : 0], out);
+        }
+        fprintf(out, "|\n");
+    }
+
+    int hot[MCLASS_HOT_SETS];
+    int num_hot = 0;
+    for (int s = 0; s < m->num_sets; s++) {
+        uint64_t count = m->set_conflicts[s];
+        if (!count) continue;
+        int i = num_hot;
+        if (i == MCLASS_HOT_SETS) {
+            if (count <= m->set_conflicts[hot[i - 1]]) continue;
+            i--;
+        } else {
+            num_hot++;
+        }
+        for (; i > 0 && m->set_conflicts[hot[i - 1]] < count; i--) {
+            hot[i] = hot[i - 1];
+        }
+        hot[i] = s;
+    }
+    fprintf(out, "  hottest sets:");
+    for (int i = 0; i < num_hot; i++) {
+        fprintf(out, " %d (%" PRIu64 ")", hot[i], m->set_conflicts[hot[i]]);
+    }
+    fprintf(out, "\n");
+}
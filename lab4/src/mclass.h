@@ -0,0 +1,64 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Three-C miss classification (Hill). Alongside a cache, a shadow fully
+ * associative LRU cache of the same capacity sees the same accesses, and a
+ * set remembers every block ever touched. A miss to a block never seen
+ * before is compulsory; one that the shadow would have hit is a conflict
+ * miss, which more ways would remove; any other miss is a capacity miss.
+ * Conflict misses are also counted per set, so hot sets show up. A miss
+ * on an invalid sector of a line that is present is none of the three and
+ * is counted on its own.
+ */
+#ifndef _MCLASS_H_
+#define _MCLASS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+/* What the real cache did with an access */
+typedef enum {
+    MCLASS_MISS = 0,
+    MCLASS_HIT,
+    MCLASS_SECTOR_MISS           /* line present, sector not valid */
+} mclass_outcome_t;
+
+typedef struct mclass {
+    int num_sets;
+    int block_bits;
+
+    /* shadow: capacity blocks in a doubly linked LRU list (block + 1,
+     * 0 = free), indexed by an open addressing table of node + 1 */
+    int capacity;
+    uint64_t *blocks;
+    int32_t *prev, *next;
+    int32_t head, tail;          /* most and least recently used, -1 = none */
+    int used;
+    int32_t *index;
+    size_t index_size;
+
+    /* every block seen so far (block + 1), open addressing */
+    uint64_t *seen;
+    size_t seen_size, seen_used;
+
+    uint64_t *set_conflicts;     /* conflict misses per set */
+
+    /* statistics */
+    uint64_t stat_compulsory;
+    uint64_t stat_capacity;
+    uint64_t stat_conflict;
+    uint64_t stat_sector;
+} mclass_t;
+
+mclass_t *mclass_new(int sets, int ways, int block_size);
+void mclass_destroy(mclass_t *m);
+void mclass_copy(mclass_t *dst, const mclass_t *src);
+mclass_t *mclass_clone(const mclass_t *src);
+void mclass_access(mclass_t *m, uint64_t addr, int set, mclass_outcome_t outcome);
+void mclass_print_stats(FILE *out, const mclass_t *m);
+void mclass_print_heatmap(FILE *out, const char *name, const mclass_t *m);
+
+#endif
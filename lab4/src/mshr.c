@@ -0,0 +1,131 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "mshr.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+void mshr_init(mshr_file_t *f, int num_entries, int max_targets)
+{
+    if (num_entries < 0 || num_entries > MSHR_MAX) {
+        fprintf(stderr, "Unsupported number of MSHRs: %d (at most %d)\n", num_entries, MSHR_MAX);
+        exit(1);
+    }
+    if (max_targets < 1) {
+        fprintf(stderr, "Unsupported number of MSHR targets: %d\n", max_targets);
+        exit(1);
+    }
+    memset(f, 0, sizeof(*f));
+    f->num_entries = num_entries;
+    f->max_targets = max_targets;
+}
+
+// Entry already fetching block_addr, or -1
+int mshr_find(const mshr_file_t *f, uint64_t block_addr)
+{
+    for (int i = 0; i < f->num_entries; i++) {
+        if (f->entry[i].valid && f->entry[i].block_addr == block_addr) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int mshr_full(const mshr_file_t *f)
+{
+    for (int i = 0; i < f->num_entries; i++) {
+        if (!f->entry[i].valid) return 0;
+    }
+    return 1;
+}
+
+// Whether no fill is outstanding
+int mshr_idle(const mshr_file_t *f)
+{
+    for (int i = 0; i < f->num_entries; i++) {
+        if (f->entry[i].valid) return 0;
+    }
+    return 1;
+}
+
+int mshr_can_merge(const mshr_file_t *f, int idx)
+{
+    return f->entry[idx].targets < f->max_targets;
+}
+
+// Start a fill for block_addr; returns the entry or -1 if none is free
+int mshr_alloc(mshr_file_t *f, uint64_t block_addr, int latency)
+{
+    for (int i = 0; i < f->num_entries; i++) {
+        mshr_t *m = &f->entry[i];
+        if (!m->valid) {
+            memset(m, 0, sizeof(*m));
+            m->valid = 1;
+            m->block_addr = block_addr;
+            m->cycles_remaining = latency;
+            f->stat_primary++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Attach an access to an entry. dest_reg < 0 for stores and for loads into
+// the zero register. The first target is the primary miss.
+int mshr_add_target(mshr_file_t *f, int idx, int dest_reg, int store_bytes)
+{
+    mshr_t *m = &f->entry[idx];
+    if (m->targets == f->max_targets) return 0;
+    if (m->targets > 0) f->stat_secondary++;
+    m->targets++;
+    m->store_bytes += store_bytes;
+    if (dest_reg >= 0) {
+        m->dest_regs |= 1u << dest_reg;
+        f->pending_regs |= 1u << dest_reg;
+    }
+    return 1;
+}
+
+// Advance every outstanding fill by a cycle; finished blocks go into c and
+// release the registers that were waiting on them
+void mshr_tick(mshr_file_t *f, cache_t *c)
+{
+    int outstanding = 0;
+    for (int i = 0; i < f->num_entries; i++) {
+        mshr_t *m = &f->entry[i];
+        if (!m->valid) continue;
+        outstanding++;
+        if (--m->cycles_remaining > 0) continue;
+
+        printf("[MSHR] fill of block 0x%lx complete, %d targets\n", m->block_addr, m->targets);
+        cache_insert(c, m->block_addr);
+        if (m->store_bytes) {
+            cache_write(c, m->block_addr, m->store_bytes);
+        }
+        f->pending_regs &= ~m->dest_regs;
+        m->valid = 0;
+    }
+
+    if (outstanding) {
+        f->stat_busy_cycles++;
+        f->stat_outstanding_sum += outstanding;
+        if (outstanding > f->stat_peak) f->stat_peak = outstanding;
+    }
+}
+
+void mshr_print_stats(FILE *out, const char *name, const mshr_file_t *f)
+{
+    if (f->num_entries == 0) return;
+    fprintf(out, "%s MSHRs: %d entries x %d targets\n", name, f->num_entries, f->max_targets);
+    fprintf(out, "  primary misses %" PRIu64 ", merged misses %" PRIu64 ", full stalls %" PRIu64 "\n",
+            f->stat_primary, f->stat_secondary, f->stat_full_stalls);
+    fprintf(out, "  cycles with misses outstanding %" PRIu64 ", average outstanding %.2f, peak %d\n",
+            f->stat_busy_cycles,
+            f->stat_busy_cycles ? (double) f->stat_outstanding_sum / f->stat_busy_cycles : 0.0,
+            f->stat_peak);
+}
@@ -0,0 +1,56 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Miss status holding registers for a lockup-free cache. Each entry tracks
+ * one outstanding block fill; later misses to the same block merge into it
+ * as extra targets. Loads that miss leave their destination register marked
+ * pending, and only instructions that need a pending register wait for the
+ * fill, so hits and independent misses proceed underneath it.
+ */
+#ifndef _MSHR_H_
+#define _MSHR_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "cache.h"
+
+/* most MSHRs a cache can be configured with */
+#define MSHR_MAX 32
+
+typedef struct mshr {
+    int valid;
+    uint64_t block_addr;
+    int cycles_remaining;
+    int targets;             /* accesses waiting on this fill */
+    uint32_t dest_regs;      /* registers written by loads waiting here */
+    int store_bytes;         /* store data to write once the block arrives */
+} mshr_t;
+
+typedef struct mshr_file {
+    int num_entries;         /* 0 = blocking cache */
+    int max_targets;
+    mshr_t entry[MSHR_MAX];
+    uint32_t pending_regs;   /* union of dest_regs over valid entries */
+
+    /* statistics */
+    uint64_t stat_primary;         /* misses that allocated an entry */
+    uint64_t stat_secondary;       /* misses merged into an existing entry */
+    uint64_t stat_full_stalls;     /* cycles the pipeline waited for an entry */
+    uint64_t stat_busy_cycles;     /* cycles with at least one miss outstanding */
+    uint64_t stat_outstanding_sum; /* outstanding misses summed over those cycles */
+    int stat_peak;
+} mshr_file_t;
+
+void mshr_init(mshr_file_t *f, int num_entries, int max_targets);
+int mshr_find(const mshr_file_t *f, uint64_t block_addr);
+int mshr_alloc(mshr_file_t *f, uint64_t block_addr, int latency);
+int mshr_add_target(mshr_file_t *f, int idx, int dest_reg, int store_bytes);
+int mshr_can_merge(const mshr_file_t *f, int idx);
+int mshr_full(const mshr_file_t *f);
+int mshr_idle(const mshr_file_t *f);
+void mshr_tick(mshr_file_t *f, cache_t *c);
+void mshr_print_stats(FILE *out, const char *name, const mshr_file_t *f);
+
+#endif
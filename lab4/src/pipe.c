@@ -7,55 +7,172 @@
 
 #include "pipe.h"
 #include "shell.h"
+#include "bdi.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 # include "cache.h"
 
-/* global pipeline state */
-Pipe_State pipe;
-Pipe_Op IF_to_DE_CURRENT;
-Pipe_Op DE_to_EX_CURRENT;
-Pipe_Op EX_to_MEM_CURRENT;
-Pipe_Op MEM_to_WB_CURRENT;
+/* global pipeline state (per host thread with CORE_THREADS) */
+CORE_LOCAL Pipe_State pipe;
+CORE_LOCAL Pipe_Op IF_to_DE_CURRENT;
+CORE_LOCAL Pipe_Op DE_to_EX_CURRENT;
+CORE_LOCAL Pipe_Op EX_to_MEM_CURRENT;
+CORE_LOCAL Pipe_Op MEM_to_WB_CURRENT;
 
-Pipe_Op IF_to_DE_PREV;
-Pipe_Op DE_to_EX_PREV;
-Pipe_Op EX_to_MEM_PREV;
-Pipe_Op MEM_to_WB_PREV;
+CORE_LOCAL Pipe_Op IF_to_DE_PREV;
+CORE_LOCAL Pipe_Op DE_to_EX_PREV;
+CORE_LOCAL Pipe_Op EX_to_MEM_PREV;
+CORE_LOCAL Pipe_Op MEM_to_WB_PREV;
 
 //STALLING LOGIC
-Pipe_Op SAVED_INSTRUCTION;
-int INSTRUCTION_SAVED = 0;
-int UPDATE_EX = 0;
-int UPDATE_EX_NEXT = 0;
-
-int HLT_FLAG = 0;
-int HLT_NEXT = 0;
-int RUN_BIT;
-uint64_t NEXT_PC;
-
-int CLEAR_DE = 0;
-int BRANCH = 0;
-int BRANCH_NEXT = 0;
-
-int DCACHE_MISS = 0; 
-int DCACHE_MISS_CYCLES_REMAINING = 0;
-uint64_t DCACHE_MISS_ADDR = 0;
-Pipe_Op DCACHE_STALLED_OP;
-cache_t *instruction_cache = NULL;
-cache_t *data_cache = NULL;
-
-int ICACHE_MISS = 0;
-int ICACHE_MISS_CYCLES_REMAINING = 0;
-uint64_t ICACHE_MISS_PC = 0;
-
-int ICACHE_MISS_CANCELLED = 0;
-int ICACHE_MISS_CANCEL_DELAY = 0;
-int DCACHE_STALLED_THIS_CYCLE = 0;
-
-int LOAD_STALL = 0;
+CORE_LOCAL Pipe_Op SAVED_INSTRUCTION;
+CORE_LOCAL int INSTRUCTION_SAVED = 0;
+CORE_LOCAL int UPDATE_EX = 0;
+CORE_LOCAL int UPDATE_EX_NEXT = 0;
+
+CORE_LOCAL int HLT_FLAG = 0;
+CORE_LOCAL int HLT_NEXT = 0;
+CORE_LOCAL int RUN_BIT;
+CORE_LOCAL uint64_t NEXT_PC;
+
+CORE_LOCAL int CLEAR_DE = 0;
+CORE_LOCAL int BRANCH = 0;
+CORE_LOCAL int BRANCH_NEXT = 0;
+
+CORE_LOCAL int DCACHE_MISS = 0; 
+CORE_LOCAL int DCACHE_MISS_LATENCY = 0;
+CORE_LOCAL int DCACHE_MISS_CYCLES_REMAINING = 0;
+CORE_LOCAL uint64_t DCACHE_MISS_ADDR = 0;
+CORE_LOCAL Pipe_Op DCACHE_STALLED_OP;
+CORE_LOCAL cache_t *instruction_cache = NULL;
+CORE_LOCAL cache_t *data_cache = NULL;
+cache_t *l2_cache = NULL;
+cache_t *l3_cache = NULL;
+
+CORE_LOCAL int ICACHE_MISS = 0;
+CORE_LOCAL int ICACHE_MISS_CYCLES_REMAINING = 0;
+CORE_LOCAL uint64_t ICACHE_MISS_PC = 0;
+
+CORE_LOCAL int ICACHE_MISS_CANCELLED = 0;
+CORE_LOCAL int ICACHE_MISS_HIT = 0;     /* the wait is a slow hit's, the block is here */
+CORE_LOCAL int ICACHE_MISS_CANCEL_DELAY = 0;
+CORE_LOCAL int DCACHE_STALLED_THIS_CYCLE = 0;
+
+CORE_LOCAL int LOAD_STALL = 0;
+
+// Lockup-free D-cache state; MSHR_STALL freezes MEM when no MSHR is free,
+// FILL_STALL holds decode on a register a fill has yet to write
+CORE_LOCAL mshr_file_t dcache_mshrs;
+CORE_LOCAL int MSHR_STALL = 0;
+CORE_LOCAL int FILL_STALL = 0;
+CORE_LOCAL storebuf_t store_buffer;
+CORE_LOCAL int STORE_STALL = 0;
+// Blocks streaming into the L1s under critical-word-first fills
+CORE_LOCAL fillbuf_t icache_fill, dcache_fill;
+
+CORE_LOCAL tlb_t *itlb = NULL;
+CORE_LOCAL tlb_t *dtlb = NULL;
+
+CORE_LOCAL dram_t *dram = NULL;
+
+CORE_LOCAL sdist_t *isdist = NULL;
+CORE_LOCAL sdist_t *dsdist = NULL;
+
+/* Multicore: the running core lives in the globals above, the others in
+ * their saved context and predictor */
+typedef struct core {
+    Pipe_Context ctx;
+    bp_t bp;
+    int halted;
+    uint32_t stat_inst_retire;
+
+    /* on a host thread (CORE_THREADS): cycles stepped and instructions
+     * retired during this pipe_run() */
+    pthread_t thread;
+    int ran;
+    uint32_t retired;
+} core_t;
+
+static core_t cores[MAX_CORES];
+static int current_core = 0;
+int num_cores = 1;
+coh_bus_t *coh_bus = NULL;
+
+/* Cores on host threads. With CORE_QUANTUM 1 they take turns in core
+ * order every cycle; with a larger quantum each runs that many cycles on
+ * its own and they meet at a barrier. */
+typedef struct {
+    int cycles;                 /* machine cycles this run may take */
+    int done;                   /* every core has halted */
+    uint64_t turn;              /* strict: cycle * num_cores + core to step */
+    int running, ticked;        /* strict: state of the current cycle */
+    int arrived, sense;         /* relaxed: barrier */
+    int dram_cycle;             /* relaxed: cycles the DRAM has ticked */
+    pthread_mutex_t lock;       /* relaxed: everything behind the L1s */
+} core_sched_t;
+
+static core_sched_t sched;
+
+/* Time slicing: counters a process is charged with over its slices */
+typedef struct {
+    uint64_t retired;
+    uint64_t imisses, dmisses, l2_misses;
+    uint64_t lines_displaced;   /* other processes' cache lines it evicted */
+    uint64_t btb_displaced;     /* and their BTB entries */
+} process_counts_t;
+
+/* Processes sharing the core: the loaded one's registers are in pipe and
+ * its memory in MEM_REGIONS, the others' here */
+typedef struct process {
+    Pipe_State state;
+    uint64_t next_pc;
+    uint8_t *mem[MEM_NREGIONS];
+    int halted;
+
+    /* hardware threads: global history, and the fill a switched-out
+     * thread waits for */
+    uint32_t ghr;
+    int waiting;
+    uint64_t fill_addr;
+    uint64_t fill_cycle;
+
+    /* statistics */
+    uint64_t stat_slices;
+    uint64_t stat_cycles;
+    process_counts_t stat;
+} process_t;
+
+static process_t processes[MAX_PROCESSES];
+static int loaded_process = 0;
+int running_process = 0;
+int num_processes = 1;
+
+static uint64_t addr_space = 0;        /* running process << CACHE_SPACE_SHIFT */
+static int SWITCH_PENDING = 0;         /* slice is up: fetch stops, pipeline drains */
+static int slice_cycles = 0;
+static uint32_t slice_first_retire = 0; /* stat_inst_retire when the slice began */
+static process_counts_t slice_mark;    /* counters when the slice began */
+
+static uint64_t mt_cycle = 0;          /* hardware threads: cycles so far */
+static int THREAD_SWITCH = 0;          /* a load missed: its thread leaves after this cycle */
+static uint64_t THREAD_RESUME_PC = 0;  /* where that thread picks up again */
+
+static uint64_t stat_switches = 0;
+static uint64_t stat_drain_cycles = 0;
+static uint64_t stat_flushed_lines = 0, stat_flushed_tlb = 0, stat_flushed_btb = 0;
+static uint64_t stat_thread_misses = 0, stat_thread_miss_cycles = 0, stat_idle_cycles = 0;
+
+// Address the caches, TLBs and MSHRs see: the running process's address
+// space goes above the guest's 48 bits (and is 0 without time slicing)
+static inline uint64_t phys(uint64_t addr)
+{
+    return addr | addr_space;
+}
 
 static void set_nop(Pipe_Op *op)
 {
@@ -87,7 +204,23 @@ uint32_t extract_bits(uint32_t instruction, int start, int end){
     uint32_t mask = (1U << width) - 1;
     return (instruction >> start) & mask;
 }
-void pipe_init()
+
+// Bytes the D-cache block at addr takes BDI-compressed, from what guest
+// memory holds there now
+static int dcache_compressed_size(uint64_t addr, int block_size)
+{
+    uint8_t block[DCACHE_BLOCK];
+    uint64_t base = addr & ((1ULL << CACHE_SPACE_SHIFT) - 1);
+    for (int i = 0; i < block_size; i += 4) {
+        uint32_t word = mem_read_32(base + i);
+        memcpy(block + i, &word, 4);
+    }
+    return bdi_compressed_size(block, block_size);
+}
+
+// Pipeline, predictor and private caches of the core in the globals; the
+// shared levels must already exist
+static void pipe_init_core(void)
 {
     memset(&pipe, 0, sizeof(Pipe_State));
     pipe.PC = 0x00400000;
@@ -97,8 +230,67 @@ void pipe_init()
     bp_t_init();
     pipe.bp = &bp;
 
-    instruction_cache = cache_new(64, 4, 32);
-    data_cache        = cache_new(256, 8, 32);
+    instruction_cache = cache_new(ICACHE_SETS, ICACHE_WAYS, ICACHE_BLOCK);
+    data_cache        = cache_new(DCACHE_SETS, DCACHE_COMPRESS ? DCACHE_WAYS * DCACHE_COMPRESS_TAGS
+                                                               : DCACHE_WAYS, DCACHE_BLOCK);
+    instruction_cache->name = "L1I";
+    data_cache->name = "L1D";
+    cache_set_policy(instruction_cache, ICACHE_REPL);
+    cache_set_policy(data_cache, DCACHE_REPL);
+    cache_set_sectors(instruction_cache, ICACHE_SECTORS);
+    cache_set_sectors(data_cache, DCACHE_SECTORS);
+    cache_set_index_fn(instruction_cache, ICACHE_INDEX);
+    cache_set_index_fn(data_cache, DCACHE_INDEX);
+    instruction_cache->hit_latency = ICACHE_HIT_CYCLES;
+    data_cache->hit_latency = DCACHE_HIT_CYCLES;
+    cache_set_way_predict(instruction_cache, ICACHE_WAY_PREDICT);
+    cache_set_way_predict(data_cache, DCACHE_WAY_PREDICT);
+    if (DCACHE_COMPRESS) {
+        cache_set_compression(data_cache, DCACHE_WAYS, DCACHE_DECOMPRESS_CYCLES, dcache_compressed_size);
+    }
+    data_cache->write_policy = DCACHE_WRITE_POLICY;
+    cache_set_prefetcher(instruction_cache, ICACHE_PREFETCH, ICACHE_PF_DEGREE, ICACHE_PF_DISTANCE);
+    cache_set_prefetcher(data_cache, DCACHE_PREFETCH, DCACHE_PF_DEGREE, DCACHE_PF_DISTANCE);
+    cache_set_victim(data_cache, DCACHE_VICTIM_ENTRIES, DCACHE_VICTIM_HIT_CYCLES);
+    mshr_init(&dcache_mshrs, DCACHE_MSHRS, DCACHE_MSHR_TARGETS);
+    storebuf_init(&store_buffer, STORE_BUFFER_ENTRIES, DCACHE_BLOCK);
+    fillbuf_init(&icache_fill, FILL_WORD, FILL_BEAT_CYCLES);
+    fillbuf_init(&dcache_fill, FILL_WORD, FILL_BEAT_CYCLES);
+
+    // Without an L2 the L1s pay MEM_CYCLES (or DRAM) themselves
+    if (l2_cache) {
+        cache_attach(instruction_cache, l2_cache);
+        cache_attach(data_cache, l2_cache);
+    } else {
+        instruction_cache->mem_latency = MEM_CYCLES;
+        data_cache->mem_latency = MEM_CYCLES;
+        if (dram) {
+            cache_set_dram(instruction_cache, dram);
+            cache_set_dram(data_cache, dram);
+        }
+    }
+
+    // TLBs, when configured, are looked up beside the L1s
+    if (ITLB_ENTRIES > 0) {
+        itlb = tlb_new("ITLB", ITLB_ENTRIES, ITLB_WAYS, ITLB_PAGE_SIZE);
+        itlb->walk_level_cycles = TLB_WALK_LEVEL_CYCLES;
+        itlb->walk_cache = TLB_WALK_VIA_DCACHE ? data_cache : NULL;
+    }
+    if (DTLB_ENTRIES > 0) {
+        dtlb = tlb_new("DTLB", DTLB_ENTRIES, DTLB_WAYS, DTLB_PAGE_SIZE);
+        dtlb->walk_level_cycles = TLB_WALK_LEVEL_CYCLES;
+        dtlb->walk_cache = TLB_WALK_VIA_DCACHE ? data_cache : NULL;
+    }
+
+    if (MISS_CLASSIFY) {
+        cache_set_classify(instruction_cache, 1);
+        cache_set_classify(data_cache, 1);
+    }
+
+    if (SDIST_PROFILE) {
+        isdist = sdist_new("I-side", ICACHE_BLOCK);
+        dsdist = sdist_new("D-side", DCACHE_BLOCK);
+    }
 
     set_nop(&IF_to_DE_CURRENT);
     set_nop(&DE_to_EX_CURRENT);
@@ -115,7 +307,565 @@ void pipe_init()
     CLEAR_DE = 0;
 }
 
-void pipe_cycle()
+void pipe_init()
+{
+    // Build the shared outer levels; whichever level is last pays MEM_CYCLES
+    cache_t *last = NULL;
+    if (L2_SETS > 0) {
+        l2_cache = cache_new(L2_SETS, L2_WAYS, L2_BLOCK);
+        l2_cache->name = "L2";
+        l2_cache->hit_latency = L2_HIT_CYCLES;
+        l2_cache->inclusion = L2_INCLUSION;
+        l2_cache->write_policy = L2_WRITE_POLICY;
+        cache_set_policy(l2_cache, L2_REPL);
+        cache_set_sectors(l2_cache, L2_SECTORS);
+        cache_set_index_fn(l2_cache, L2_INDEX);
+        last = l2_cache;
+        if (L3_SETS > 0) {
+            l3_cache = cache_new(L3_SETS, L3_WAYS, L3_BLOCK);
+            l3_cache->name = "L3";
+            l3_cache->hit_latency = L3_HIT_CYCLES;
+            l3_cache->inclusion = L3_INCLUSION;
+            l3_cache->write_policy = L3_WRITE_POLICY;
+            cache_set_policy(l3_cache, L3_REPL);
+            cache_set_sectors(l3_cache, L3_SECTORS);
+            cache_set_index_fn(l3_cache, L3_INDEX);
+            cache_attach(l2_cache, l3_cache);
+            last = l3_cache;
+        }
+        last->mem_latency = MEM_CYCLES;
+    }
+
+    // With a DRAM model, its timing replaces MEM_CYCLES
+    if (DRAM_CHANNELS > 0) {
+        dram = dram_new(DRAM_CHANNELS, DRAM_RANKS, DRAM_BANKS, DRAM_ROW_SIZE);
+        dram->page_policy = DRAM_PAGE_POLICY;
+        dram->scheduler = DRAM_SCHEDULER;
+        dram->tRCD = DRAM_TRCD;
+        dram->tRP = DRAM_TRP;
+        dram->tCAS = DRAM_TCAS;
+        dram->tBURST = DRAM_TBURST;
+        dram->ctrl_cycles = DRAM_CTRL_CYCLES;
+        if (last) {
+            cache_set_dram(last, dram);
+        }
+    }
+
+    if (MISS_CLASSIFY) {
+        if (l2_cache) cache_set_classify(l2_cache, 1);
+        if (l3_cache) cache_set_classify(l3_cache, 1);
+    }
+
+    pipe_init_core();
+}
+
+// Park the running core and start a new one with its own pipeline,
+// predictor and L1s behind the shared levels. Its L1D joins the others on
+// the coherence bus.
+void pipe_add_core()
+{
+    if (num_cores == MAX_CORES) {
+        fprintf(stderr, "At most %d cores\n", MAX_CORES);
+        exit(1);
+    }
+
+    Pipe_Context fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    fresh.dram = dram;
+    pipe_save(&cores[current_core].ctx);
+    cores[current_core].bp = bp;
+    current_core = num_cores++;
+    pipe_restore(&fresh);
+    pipe_init_core();
+
+    if (!coh_bus) {
+        coh_bus = coh_new(COH_TRANSFER_CYCLES);
+        coh_attach(coh_bus, cores[0].ctx.data_cache);
+    }
+    coh_attach(coh_bus, data_cache);
+
+    // Relaxed threads reach the shared levels and each other's L1s only
+    // under the lock, and through the L1s' inboxes
+    if (CORE_THREADS && CORE_QUANTUM > 1) {
+        if (num_cores == 2) {
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+            pthread_mutex_init(&sched.lock, &attr);
+            pthread_mutexattr_destroy(&attr);
+            cache_set_lock(cores[0].ctx.instruction_cache, &sched.lock);
+            cache_set_lock(cores[0].ctx.data_cache, &sched.lock);
+        }
+        cache_set_lock(instruction_cache, &sched.lock);
+        cache_set_lock(data_cache, &sched.lock);
+    }
+}
+
+// Start the core in the globals at pc
+void pipe_set_entry(uint64_t pc)
+{
+    pipe.PC = pc;
+    NEXT_PC = pc;
+}
+
+// Load core's state into the pipeline globals
+void pipe_switch_core(int core)
+{
+    if (core == current_core) return;
+    pipe_save(&cores[current_core].ctx);
+    cores[current_core].bp = bp;
+    current_core = core;
+    pipe_restore(&cores[core].ctx);
+    bp = cores[core].bp;
+}
+
+// Park the running process and start a new one on the same core, with
+// registers of its own and an empty address space
+void pipe_add_process()
+{
+    if (HW_THREADS > 0) {
+        if (num_processes == HW_THREADS) {
+            fprintf(stderr, "At most %d hardware threads\n", HW_THREADS);
+            exit(1);
+        }
+        if (DCACHE_MSHRS > 0) {
+            fprintf(stderr, "Hardware threads switch on blocking D-cache misses; build with DCACHE_MSHRS=0\n");
+            exit(1);
+        }
+    } else if (num_processes == MAX_PROCESSES) {
+        fprintf(stderr, "At most %d processes\n", MAX_PROCESSES);
+        exit(1);
+    }
+
+    process_t *p = &processes[num_processes];
+    for (int i = 0; i < MEM_NREGIONS; i++) {
+        p->mem[i] = (uint8_t *) calloc(MEM_REGIONS[i].size, 1);
+        if (!p->mem[i]) {
+            fprintf(stderr, "Failed to allocate memory for process %d\n", num_processes);
+            exit(1);
+        }
+    }
+    memset(&p->state, 0, sizeof(Pipe_State));
+    p->state.bp = &bp;
+    p->state.PC = 0x00400000;
+    p->next_pc = p->state.PC;
+
+    // Process 0 holds the first slice
+    processes[0].stat_slices = 1;
+    pipe_switch_process(num_processes++);
+}
+
+// Load process's registers and memory into the globals. Only the running
+// process may advance; the others are loaded to be looked at or set up.
+void pipe_switch_process(int process)
+{
+    if (process == loaded_process) return;
+    process_t *out = &processes[loaded_process];
+    process_t *in = &processes[process];
+    out->state = pipe;
+    out->next_pc = NEXT_PC;
+    pipe = in->state;
+    NEXT_PC = in->next_pc;
+    for (int i = 0; i < MEM_NREGIONS; i++) {
+        out->mem[i] = MEM_REGIONS[i].mem;
+        MEM_REGIONS[i].mem = in->mem[i];
+    }
+    loaded_process = process;
+}
+
+static void process_counts(process_counts_t *c)
+{
+    c->retired = stat_inst_retire;
+    c->imisses = instruction_cache->stat_misses;
+    c->dmisses = data_cache->stat_misses;
+    c->l2_misses = l2_cache ? l2_cache->stat_misses : 0;
+    c->lines_displaced = instruction_cache->stat_cross_evictions +
+                         data_cache->stat_cross_evictions +
+                         (l2_cache ? l2_cache->stat_cross_evictions : 0) +
+                         (l3_cache ? l3_cache->stat_cross_evictions : 0);
+    c->btb_displaced = bp.stat_cross_evictions;
+}
+
+// Charge the running process with what happened since the last charge
+static void process_charge(void)
+{
+    process_counts_t now;
+    process_counts(&now);
+    process_counts_t *total = &processes[running_process].stat;
+    total->retired += now.retired - slice_mark.retired;
+    total->imisses += now.imisses - slice_mark.imisses;
+    total->dmisses += now.dmisses - slice_mark.dmisses;
+    total->l2_misses += now.l2_misses - slice_mark.l2_misses;
+    total->lines_displaced += now.lines_displaced - slice_mark.lines_displaced;
+    total->btb_displaced += now.btb_displaced - slice_mark.btb_displaced;
+    slice_mark = now;
+}
+
+// Nothing of the running process is left in flight
+static int pipe_drained(void)
+{
+    return IF_to_DE_PREV.NOP && DE_to_EX_PREV.NOP && EX_to_MEM_PREV.NOP && MEM_to_WB_PREV.NOP &&
+           !UPDATE_EX && !DCACHE_MISS && DCACHE_MISS_CYCLES_REMAINING == 0 &&
+           mshr_idle(&dcache_mshrs) && !ICACHE_MISS;
+}
+
+// Context switch on a drained pipeline: next resumes from its saved
+// registers, in its own address space
+static void process_switch(int next)
+{
+    process_charge();
+    pipe_switch_process(next);
+    running_process = next;
+    addr_space = (uint64_t) next << CACHE_SPACE_SHIFT;
+    bp.space = addr_space;
+    if (HW_THREADS > 0) {
+        bp.ghr = processes[next].ghr;
+    } else if (SWITCH_FLUSH) {
+        stat_flushed_lines += cache_flush(instruction_cache) + cache_flush(data_cache);
+        stat_flushed_tlb += tlb_flush(itlb) + tlb_flush(dtlb);
+        stat_flushed_btb += bp_flush_btb();
+    }
+
+    // A hardware thread switched out on a load miss abandons its fetch
+    // miss; a time slice has waited for it while draining
+    ICACHE_MISS = 0;
+    ICACHE_MISS_CYCLES_REMAINING = 0;
+    ICACHE_MISS_CANCELLED = 0;
+    HLT_FLAG = 0;
+    HLT_NEXT = 0;
+    SWITCH_PENDING = 0;
+    slice_cycles = 0;
+    slice_first_retire = stat_inst_retire;
+    processes[next].stat_slices++;
+    stat_switches++;
+}
+
+// Next hardware thread after the running one that has not halted and is
+// not waiting for a fill, or -1
+static int thread_next_ready(void)
+{
+    for (int i = 1; i < num_processes; i++) {
+        int t = (running_process + i) % num_processes;
+        if (!processes[t].halted && !processes[t].waiting) return t;
+    }
+    return -1;
+}
+
+// Switch-on-miss, from MEM: if another hardware thread is ready, the
+// load's thread leaves the pipeline until the fill is in and the load is
+// replayed. Returns whether it does.
+static int thread_miss(uint64_t pc, uint64_t addr, int latency)
+{
+    if (HW_THREADS == 0 || num_processes == 1 || thread_next_ready() < 0) return 0;
+    process_t *p = &processes[running_process];
+    p->waiting = 1;
+    p->fill_addr = addr;
+    p->fill_cycle = mt_cycle + latency;
+    // Branches behind the load update the history this cycle; they rerun
+    p->ghr = bp.ghr;
+    THREAD_SWITCH = 1;
+    THREAD_RESUME_PC = pc;
+    stat_thread_misses++;
+    stat_thread_miss_cycles += latency;
+    return 1;
+}
+
+// Hardware threads, after every cycle: fills complete off the pipeline, a
+// thread whose load missed is squashed from that load on and switched
+// out, and a halted thread hands over to a ready one. While the others
+// all wait for fills the core idles.
+static void pipe_hw_threads(void)
+{
+    process_t *p = &processes[running_process];
+    mt_cycle++;
+    if (p->halted) {
+        stat_idle_cycles++;
+    } else {
+        p->stat_cycles++;
+    }
+    for (int i = 0; i < num_processes; i++) {
+        process_t *t = &processes[i];
+        if (t->waiting && mt_cycle >= t->fill_cycle) {
+            cache_insert(data_cache, t->fill_addr);
+            t->waiting = 0;
+        }
+    }
+    if (!RUN_BIT) {
+        p->halted = 1;
+    }
+
+    if (THREAD_SWITCH) {
+        // Nothing from the load on has written registers or memory
+        set_nop(&EX_to_MEM_PREV);
+        set_nop(&DE_to_EX_PREV);
+        set_nop(&IF_to_DE_PREV);
+        pipe.PC = THREAD_RESUME_PC;
+        NEXT_PC = THREAD_RESUME_PC;
+        UPDATE_EX = 0;
+        BRANCH = 0;
+        THREAD_SWITCH = 0;
+        process_switch(thread_next_ready());
+        return;
+    }
+    if (!p->halted) return;
+
+    int next = thread_next_ready();
+    if (next >= 0) {
+        process_switch(next);
+        RUN_BIT = TRUE;
+        return;
+    }
+    for (int i = 0; i < num_processes; i++) {
+        if (processes[i].waiting) {
+            RUN_BIT = TRUE;
+            return;
+        }
+    }
+}
+
+// Round-robin scheduler, after every cycle: once the running process's
+// slice is up or it has halted, fetch stops, and when the pipeline has
+// drained the next process that has not halted takes over. RUN_BIT drops
+// only when every process has halted.
+static void pipe_time_slice(void)
+{
+    process_t *p = &processes[running_process];
+    p->stat_cycles++;
+    if (SWITCH_PENDING) {
+        stat_drain_cycles++;
+    }
+    if (!RUN_BIT) {
+        p->halted = 1;
+    }
+
+    int next = running_process;
+    do {
+        next = (next + 1) % num_processes;
+    } while (next != running_process && processes[next].halted);
+    if (next == running_process) return;
+
+    // A slice runs on until it has retired something, so a slice shorter
+    // than a fetch miss still makes progress when the switch flushes the L1s
+    if (!p->halted && (++slice_cycles < TIME_SLICE || stat_inst_retire == slice_first_retire)) return;
+    RUN_BIT = TRUE;
+    SWITCH_PENDING = 1;
+    if (pipe_drained()) {
+        process_switch(next);
+    }
+}
+
+void pipe_save(Pipe_Context *ctx)
+{
+    ctx->pipe = pipe;
+    ctx->IF_to_DE_CURRENT = IF_to_DE_CURRENT;
+    ctx->DE_to_EX_CURRENT = DE_to_EX_CURRENT;
+    ctx->EX_to_MEM_CURRENT = EX_to_MEM_CURRENT;
+    ctx->MEM_to_WB_CURRENT = MEM_to_WB_CURRENT;
+    ctx->IF_to_DE_PREV = IF_to_DE_PREV;
+    ctx->DE_to_EX_PREV = DE_to_EX_PREV;
+    ctx->EX_to_MEM_PREV = EX_to_MEM_PREV;
+    ctx->MEM_to_WB_PREV = MEM_to_WB_PREV;
+    ctx->SAVED_INSTRUCTION = SAVED_INSTRUCTION;
+    ctx->INSTRUCTION_SAVED = INSTRUCTION_SAVED;
+    ctx->UPDATE_EX = UPDATE_EX;
+    ctx->UPDATE_EX_NEXT = UPDATE_EX_NEXT;
+    ctx->HLT_FLAG = HLT_FLAG;
+    ctx->HLT_NEXT = HLT_NEXT;
+    ctx->RUN_BIT = RUN_BIT;
+    ctx->NEXT_PC = NEXT_PC;
+    ctx->CLEAR_DE = CLEAR_DE;
+    ctx->BRANCH = BRANCH;
+    ctx->BRANCH_NEXT = BRANCH_NEXT;
+    ctx->DCACHE_MISS = DCACHE_MISS;
+    ctx->DCACHE_MISS_LATENCY = DCACHE_MISS_LATENCY;
+    ctx->DCACHE_MISS_CYCLES_REMAINING = DCACHE_MISS_CYCLES_REMAINING;
+    ctx->DCACHE_MISS_ADDR = DCACHE_MISS_ADDR;
+    ctx->DCACHE_STALLED_OP = DCACHE_STALLED_OP;
+    ctx->instruction_cache = instruction_cache;
+    ctx->data_cache = data_cache;
+    ctx->ICACHE_MISS = ICACHE_MISS;
+    ctx->ICACHE_MISS_CYCLES_REMAINING = ICACHE_MISS_CYCLES_REMAINING;
+    ctx->ICACHE_MISS_PC = ICACHE_MISS_PC;
+    ctx->ICACHE_MISS_CANCELLED = ICACHE_MISS_CANCELLED;
+    ctx->ICACHE_MISS_HIT = ICACHE_MISS_HIT;
+    ctx->ICACHE_MISS_CANCEL_DELAY = ICACHE_MISS_CANCEL_DELAY;
+    ctx->DCACHE_STALLED_THIS_CYCLE = DCACHE_STALLED_THIS_CYCLE;
+    ctx->LOAD_STALL = LOAD_STALL;
+    ctx->dcache_mshrs = dcache_mshrs;
+    ctx->itlb = itlb;
+    ctx->dtlb = dtlb;
+    ctx->dram = dram;
+    ctx->isdist = isdist;
+    ctx->dsdist = dsdist;
+    ctx->MSHR_STALL = MSHR_STALL;
+    ctx->FILL_STALL = FILL_STALL;
+    ctx->store_buffer = store_buffer;
+    ctx->STORE_STALL = STORE_STALL;
+    ctx->icache_fill = icache_fill;
+    ctx->dcache_fill = dcache_fill;
+}
+
+void pipe_restore(const Pipe_Context *ctx)
+{
+    pipe = ctx->pipe;
+    IF_to_DE_CURRENT = ctx->IF_to_DE_CURRENT;
+    DE_to_EX_CURRENT = ctx->DE_to_EX_CURRENT;
+    EX_to_MEM_CURRENT = ctx->EX_to_MEM_CURRENT;
+    MEM_to_WB_CURRENT = ctx->MEM_to_WB_CURRENT;
+    IF_to_DE_PREV = ctx->IF_to_DE_PREV;
+    DE_to_EX_PREV = ctx->DE_to_EX_PREV;
+    EX_to_MEM_PREV = ctx->EX_to_MEM_PREV;
+    MEM_to_WB_PREV = ctx->MEM_to_WB_PREV;
+    SAVED_INSTRUCTION = ctx->SAVED_INSTRUCTION;
+    INSTRUCTION_SAVED = ctx->INSTRUCTION_SAVED;
+    UPDATE_EX = ctx->UPDATE_EX;
+    UPDATE_EX_NEXT = ctx->UPDATE_EX_NEXT;
+    HLT_FLAG = ctx->HLT_FLAG;
+    HLT_NEXT = ctx->HLT_NEXT;
+    RUN_BIT = ctx->RUN_BIT;
+    NEXT_PC = ctx->NEXT_PC;
+    CLEAR_DE = ctx->CLEAR_DE;
+    BRANCH = ctx->BRANCH;
+    BRANCH_NEXT = ctx->BRANCH_NEXT;
+    DCACHE_MISS = ctx->DCACHE_MISS;
+    DCACHE_MISS_LATENCY = ctx->DCACHE_MISS_LATENCY;
+    DCACHE_MISS_CYCLES_REMAINING = ctx->DCACHE_MISS_CYCLES_REMAINING;
+    DCACHE_MISS_ADDR = ctx->DCACHE_MISS_ADDR;
+    DCACHE_STALLED_OP = ctx->DCACHE_STALLED_OP;
+    instruction_cache = ctx->instruction_cache;
+    data_cache = ctx->data_cache;
+    ICACHE_MISS = ctx->ICACHE_MISS;
+    ICACHE_MISS_CYCLES_REMAINING = ctx->ICACHE_MISS_CYCLES_REMAINING;
+    ICACHE_MISS_PC = ctx->ICACHE_MISS_PC;
+    ICACHE_MISS_CANCELLED = ctx->ICACHE_MISS_CANCELLED;
+    ICACHE_MISS_HIT = ctx->ICACHE_MISS_HIT;
+    ICACHE_MISS_CANCEL_DELAY = ctx->ICACHE_MISS_CANCEL_DELAY;
+    DCACHE_STALLED_THIS_CYCLE = ctx->DCACHE_STALLED_THIS_CYCLE;
+    LOAD_STALL = ctx->LOAD_STALL;
+    dcache_mshrs = ctx->dcache_mshrs;
+    itlb = ctx->itlb;
+    dtlb = ctx->dtlb;
+    dram = ctx->dram;
+    isdist = ctx->isdist;
+    dsdist = ctx->dsdist;
+    MSHR_STALL = ctx->MSHR_STALL;
+    FILL_STALL = ctx->FILL_STALL;
+    store_buffer = ctx->store_buffer;
+    STORE_STALL = ctx->STORE_STALL;
+    icache_fill = ctx->icache_fill;
+    dcache_fill = ctx->dcache_fill;
+}
+
+static void pipe_print_processes(FILE *out)
+{
+    process_charge();
+    fprintf(out, "Time slicing: %d processes, %d-cycle slices, %s\n", num_processes, TIME_SLICE,
+            SWITCH_FLUSH ? "L1s, TLBs and BTB flushed on a switch" : "address-space tagged");
+    fprintf(out, "  switches %" PRIu64 ", drain cycles %" PRIu64 " (%.1f per switch)\n",
+            stat_switches, stat_drain_cycles,
+            stat_switches ? (double) stat_drain_cycles / stat_switches : 0.0);
+    if (SWITCH_FLUSH) {
+        fprintf(out, "  flushed: cache lines %" PRIu64 ", TLB entries %" PRIu64 ", BTB entries %" PRIu64 "\n",
+                stat_flushed_lines, stat_flushed_tlb, stat_flushed_btb);
+    }
+    for (int i = 0; i < num_processes; i++) {
+        const process_t *p = &processes[i];
+        fprintf(out, "  process %d: %" PRIu64 " slices, %" PRIu64 " cycles, %" PRIu64
+                " instructions, IPC %.3f%s\n", i, p->stat_slices, p->stat_cycles, p->stat.retired,
+                p->stat_cycles ? (double) p->stat.retired / p->stat_cycles : 0.0,
+                p->halted ? ", halted" : "");
+        fprintf(out, "    misses: L1I %" PRIu64 ", L1D %" PRIu64 ", L2 %" PRIu64
+                "; evicted other processes' cache lines %" PRIu64 ", BTB entries %" PRIu64 "\n",
+                p->stat.imisses, p->stat.dmisses, p->stat.l2_misses,
+                p->stat.lines_displaced, p->stat.btb_displaced);
+    }
+}
+
+static void pipe_print_threads(FILE *out)
+{
+    process_charge();
+    uint64_t retired = 0;
+    for (int i = 0; i < num_processes; i++) {
+        retired += processes[i].stat.retired;
+    }
+    fprintf(out, "Hardware threads: %d, switching on a D-cache miss\n", num_processes);
+    fprintf(out, "  switches %" PRIu64 ", misses switched on %" PRIu64 " (%" PRIu64
+            " cycles of latency), idle cycles %" PRIu64 "\n",
+            stat_switches, stat_thread_misses, stat_thread_miss_cycles, stat_idle_cycles);
+    fprintf(out, "  throughput: %" PRIu64 " instructions in %" PRIu64 " cycles, IPC %.3f\n",
+            retired, mt_cycle, mt_cycle ? (double) retired / mt_cycle : 0.0);
+    for (int i = 0; i < num_processes; i++) {
+        const process_t *p = &processes[i];
+        fprintf(out, "  thread %d: %" PRIu64 " instructions, IPC %.3f (%.3f while running), %"
+                PRIu64 " cycles in %" PRIu64 " turns%s\n", i, p->stat.retired,
+                mt_cycle ? (double) p->stat.retired / mt_cycle : 0.0,
+                p->stat_cycles ? (double) p->stat.retired / p->stat_cycles : 0.0,
+                p->stat_cycles, p->stat_slices, p->halted ? ", halted" : "");
+        fprintf(out, "    misses: L1I %" PRIu64 ", L1D %" PRIu64 ", L2 %" PRIu64
+                "; evicted other threads' cache lines %" PRIu64 ", BTB entries %" PRIu64 "\n",
+                p->stat.imisses, p->stat.dmisses, p->stat.l2_misses,
+                p->stat.lines_displaced, p->stat.btb_displaced);
+    }
+}
+
+void pipe_print_stats(FILE *out)
+{
+    if (num_processes > 1 && HW_THREADS > 0) {
+        pipe_print_threads(out);
+    } else if (num_processes > 1) {
+        pipe_print_processes(out);
+    }
+    // Private levels core by core, then the shared ones
+    for (int i = 0; i < num_cores; i++) {
+        pipe_switch_core(i);
+        uint32_t retired = num_cores > 1 ? cores[i].stat_inst_retire : stat_inst_retire;
+        if (num_cores > 1) {
+            fprintf(out, "Core %d: %u instructions retired\n", i, retired);
+        }
+        cache_print_stats(out, instruction_cache);
+        fillbuf_print_stats(out, instruction_cache->name, &icache_fill);
+        cache_print_stats(out, data_cache);
+        fillbuf_print_stats(out, data_cache->name, &dcache_fill);
+        mshr_print_stats(out, data_cache->name, &dcache_mshrs);
+        storebuf_print_stats(out, data_cache->name, &store_buffer);
+        tlb_print_stats(out, itlb, retired);
+        tlb_print_stats(out, dtlb, retired);
+        sdist_print_stats(out, isdist);
+        sdist_print_stats(out, dsdist);
+    }
+    pipe_switch_core(0);
+    cache_print_stats(out, l2_cache);
+    cache_print_stats(out, l3_cache);
+    dram_print_stats(out, dram);
+    coh_print_stats(out, coh_bus);
+    fprintf(out, "\n");
+}
+
+void pipe_write_curves(FILE *out)
+{
+    sdist_write_csv(out, isdist, 1);
+    sdist_write_csv(out, dsdist, 0);
+}
+
+void pipe_print_heatmaps(FILE *out)
+{
+    for (int i = 0; i < num_cores; i++) {
+        pipe_switch_core(i);
+        if (num_cores > 1) {
+            fprintf(out, "Core %d:\n", i);
+        }
+        mclass_print_heatmap(out, instruction_cache->name, instruction_cache->mclass);
+        mclass_print_heatmap(out, data_cache->name, data_cache->mclass);
+    }
+    pipe_switch_core(0);
+    if (l2_cache) mclass_print_heatmap(out, l2_cache->name, l2_cache->mclass);
+    if (l3_cache) mclass_print_heatmap(out, l3_cache->name, l3_cache->mclass);
+    fprintf(out, "\n");
+}
+
+// One cycle of the core in the globals; shared levels tick only with
+// tick_shared, once per machine cycle
+static void pipe_cycle_core(int tick_shared)
 {
     printf("\n[CYCLE START] ============================================\n");
     printf("[CYCLE START] IF_to_DE_PREV: PC=0x%lx, NOP=%d, INST=%d\n", 
@@ -130,6 +880,17 @@ void pipe_cycle()
            MEM_to_WB_PREV.PC, MEM_to_WB_PREV.NOP, MEM_to_WB_PREV.INSTRUCTION,
            MEM_to_WB_PREV.LOAD, MEM_to_WB_PREV.RT_REG, MEM_to_WB_PREV.MEM_DATA);
     
+    // Outstanding non-blocking fills and prefetches make progress every cycle
+    mshr_tick(&dcache_mshrs, data_cache);
+    storebuf_tick(&store_buffer, data_cache);
+    cache_tick(instruction_cache);
+    cache_tick(data_cache);
+    fillbuf_tick(&icache_fill, instruction_cache);
+    fillbuf_tick(&dcache_fill, data_cache);
+    if (tick_shared) {
+        dram_tick(dram);
+    }
+
     if (DCACHE_MISS_CYCLES_REMAINING > 0) {
         DCACHE_MISS_CYCLES_REMAINING--; 
         printf("[CYCLE] D-cache stall, cycles remaining: %d\n", DCACHE_MISS_CYCLES_REMAINING);
@@ -148,9 +909,21 @@ void pipe_cycle()
         pipe_stage_decode();
         pipe_stage_fetch(); 
         
+        // While MEM holds, everything behind it holds too, so an HLT decoded
+        // this cycle is decoded again rather than taking effect now
         if (DCACHE_MISS == 1) {
-            DCACHE_MISS_CYCLES_REMAINING = 49;
+            DCACHE_MISS_CYCLES_REMAINING = DCACHE_MISS_LATENCY - 1;
             MEM_to_WB_PREV.NOP = 1;
+            HLT_NEXT = HLT_FLAG;
+        } else if (MSHR_STALL || STORE_STALL) {
+            // MEM retries next cycle
+            MEM_to_WB_PREV.NOP = 1;
+            HLT_NEXT = HLT_FLAG;
+        } else if (FILL_STALL) {
+            // The bubble moves into EX; decode, fetch and the PC hold
+            MEM_to_WB_PREV = MEM_to_WB_CURRENT;
+            EX_to_MEM_PREV = EX_to_MEM_CURRENT;
+            DE_to_EX_PREV = DE_to_EX_CURRENT;
         } else if (LOAD_STALL) {
             MEM_to_WB_PREV = MEM_to_WB_CURRENT;
             EX_to_MEM_PREV = EX_to_MEM_CURRENT;
@@ -179,9 +952,195 @@ void pipe_cycle()
     HLT_FLAG = HLT_NEXT;
     CLEAR_DE = 0;
     LOAD_STALL = 0;
+    MSHR_STALL = 0;
+    FILL_STALL = 0;
+    STORE_STALL = 0;
     printf("[CYCLE END] ==============================================\n\n");
 }
 
+// One machine cycle: every core that has not halted advances one cycle.
+// Between cycles core 0 is loaded and RUN_BIT says whether any core runs.
+void pipe_cycle()
+{
+    if (num_cores == 1) {
+        pipe_cycle_core(1);
+        if (num_processes > 1 && HW_THREADS > 0) {
+            pipe_hw_threads();
+        } else if (num_processes > 1) {
+            pipe_time_slice();
+        }
+        return;
+    }
+
+    int running = 0, ticked = 0;
+    for (int i = 0; i < num_cores; i++) {
+        if (cores[i].halted) continue;
+        pipe_switch_core(i);
+        uint32_t retired = stat_inst_retire;
+        pipe_cycle_core(!ticked);
+        ticked = 1;
+        cores[i].stat_inst_retire += stat_inst_retire - retired;
+        cores[i].halted = !RUN_BIT;
+        running |= RUN_BIT;
+    }
+    pipe_switch_core(0);
+    RUN_BIT = running;
+}
+
+// Strict: each core steps in turn, in core order, exactly as pipe_cycle()
+// does on one thread; a core starts its cycle once the one before it has
+// finished
+static void core_run_strict(int id)
+{
+    core_t *core = &cores[id];
+    for (int cycle = 0; cycle < sched.cycles; cycle++) {
+        uint64_t turn = (uint64_t) cycle * num_cores + id;
+        while (__atomic_load_n(&sched.turn, __ATOMIC_ACQUIRE) != turn) {
+            sched_yield();
+        }
+        if (sched.done) {
+            __atomic_store_n(&sched.turn, turn + 1, __ATOMIC_RELEASE);
+            return;
+        }
+
+        if (id == 0) {
+            sched.running = 0;
+            sched.ticked = 0;
+        }
+        if (!core->halted) {
+            pipe_cycle_core(!sched.ticked);
+            sched.ticked = 1;
+            core->halted = !RUN_BIT;
+            core->ran = cycle + 1;
+            sched.running |= RUN_BIT;
+        }
+        if (id == num_cores - 1 && !sched.running) {
+            sched.done = 1;
+        }
+        __atomic_store_n(&sched.turn, turn + 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Relaxed: the DRAM keeps time with the core furthest ahead
+static void core_tick_dram(int cycle)
+{
+    if (!dram || __atomic_load_n(&sched.dram_cycle, __ATOMIC_ACQUIRE) > cycle) return;
+    pthread_mutex_lock(&sched.lock);
+    while (sched.dram_cycle <= cycle) {
+        dram_tick(dram);
+        __atomic_store_n(&sched.dram_cycle, sched.dram_cycle + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&sched.lock);
+}
+
+// Sense-reversing barrier on one counter: the last core to arrive checks
+// whether any core still runs, then releases the others
+static void core_barrier(int sense)
+{
+    if (__atomic_add_fetch(&sched.arrived, 1, __ATOMIC_ACQ_REL) == num_cores) {
+        int running = 0;
+        for (int i = 0; i < num_cores; i++) {
+            running |= !cores[i].halted;
+        }
+        sched.done = !running;
+        sched.arrived = 0;
+        __atomic_store_n(&sched.sense, sense, __ATOMIC_RELEASE);
+        return;
+    }
+    while (__atomic_load_n(&sched.sense, __ATOMIC_ACQUIRE) != sense) {
+        sched_yield();
+    }
+}
+
+// Relaxed: each core runs a quantum on its own, taking in what the others
+// sent its L1s at the start of every cycle, then waits at the barrier
+static void core_run_relaxed(int id)
+{
+    core_t *core = &cores[id];
+    int sense = 0;
+    for (int start = 0; start < sched.cycles && !sched.done; ) {
+        int end = sched.cycles - start > CORE_QUANTUM ? start + CORE_QUANTUM : sched.cycles;
+        for (int cycle = start; cycle < end && !core->halted; cycle++) {
+            cache_drain(instruction_cache);
+            cache_drain(data_cache);
+            core_tick_dram(cycle);
+            pipe_cycle_core(0);
+            core->halted = !RUN_BIT;
+            core->ran = cycle + 1;
+        }
+        start = end;
+        sense = !sense;
+        core_barrier(sense);
+    }
+    // Draining sends nothing on, so this catches up on everything
+    cache_drain(instruction_cache);
+    cache_drain(data_cache);
+}
+
+static void *core_thread(void *arg)
+{
+    int id = (int) (intptr_t) arg;
+    core_t *core = &cores[id];
+
+    pipe_restore(&core->ctx);
+    bp = core->bp;
+    if (CORE_QUANTUM > 1) {
+        core_run_relaxed(id);
+    } else {
+        core_run_strict(id);
+    }
+    pipe_save(&core->ctx);
+    core->bp = bp;
+    core->retired = stat_inst_retire;
+    return NULL;
+}
+
+// Advance the machine by up to cycles cycles, fewer if every core halts
+// first; returns the cycles taken. With CORE_THREADS each core of a
+// multicore machine runs on its own host thread for the whole call.
+int pipe_run(int cycles)
+{
+    if (!CORE_THREADS || num_cores == 1) {
+        int ran = 0;
+        while (ran < cycles && RUN_BIT) {
+            pipe_cycle();
+            ran++;
+        }
+        return ran;
+    }
+
+    // The threads pick the cores up from their saved contexts
+    pipe_save(&cores[current_core].ctx);
+    cores[current_core].bp = bp;
+    sched.cycles = cycles;
+    sched.done = 0;
+    sched.turn = 0;
+    sched.arrived = 0;
+    sched.sense = 0;
+    sched.dram_cycle = 0;
+    for (int i = 0; i < num_cores; i++) {
+        cores[i].ran = 0;
+        cores[i].retired = 0;
+        if (pthread_create(&cores[i].thread, NULL, core_thread, (void *) (intptr_t) i) != 0) {
+            fprintf(stderr, "Failed to start the thread for core %d\n", i);
+            exit(1);
+        }
+    }
+
+    int ran = 0, running = 0;
+    for (int i = 0; i < num_cores; i++) {
+        pthread_join(cores[i].thread, NULL);
+        if (cores[i].ran > ran) ran = cores[i].ran;
+        running |= !cores[i].halted;
+        cores[i].stat_inst_retire += cores[i].retired;
+        stat_inst_retire += cores[i].retired;
+    }
+    pipe_restore(&cores[current_core].ctx);
+    bp = cores[current_core].bp;
+    RUN_BIT = running;
+    return ran;
+}
+
 void write_register(int reg_num, int64_t value){
     if (reg_num != 31){
         pipe.REGS[reg_num] = value; 
@@ -211,6 +1170,7 @@ void pipe_stage_wb()
         case SUBS_EXT:
         case CMP_IMM:
         case CMP_EXT:
+        case ANDS_SHIFTR:
             // These instructions compute flags in EX; just commit them here.
             pipe.FLAG_Z = in.FLAG_Z;
             pipe.FLAG_N = in.FLAG_N;
@@ -250,6 +1210,101 @@ void pipe_stage_wb()
 }
 
 
+static int store_bytes(instruction_type_t inst)
+{
+    switch (inst) {
+        case STUR_64: return 8;
+        case STUR_32: return 4;
+        case STURH:   return 2;
+        default:      return 1;
+    }
+}
+
+// Start filling addr's block into an L1 after delay cycles (a page walk)
+// and return the cycles until the bytes at addr can be used: the whole
+// fill, or under critical-word-first fills just until those words are in
+static int l1_fill(fillbuf_t *f, cache_t *c, uint64_t addr, int bytes, int delay)
+{
+    int latency = cache_miss_latency(c, addr);
+    if (f->beat_cycles == 0) {
+        return delay + latency;
+    }
+    return fillbuf_start(f, c, addr, bytes, delay, latency);
+}
+
+static int load_bytes(instruction_type_t inst)
+{
+    switch (inst) {
+        case LDUR_64: return 8;
+        case LDUR_32: return 4;
+        case LDURH:   return 2;
+        default:      return 1;
+    }
+}
+
+// With a store buffer, stores go into it instead of the D-cache, and a
+// load whose bytes it holds is forwarded from it. Returns 1 if the buffer
+// served the access, 0 if the D-cache has to, and -1 if the buffer is full
+// and MEM has to retry next cycle.
+static int store_buffer_access(const Pipe_Op *in)
+{
+    uint64_t addr = phys(in->MEM_ADDRESS);
+    if (in->LOAD) {
+        return storebuf_forward(&store_buffer, addr, load_bytes(in->INSTRUCTION));
+    }
+    if (!storebuf_put(&store_buffer, addr, store_bytes(in->INSTRUCTION))) {
+        return -1;
+    }
+    // Translation happens here too, but the buffer hides any walk
+    tlb_translate(dtlb, addr);
+    sdist_access(dsdist, addr);
+    return 1;
+}
+
+// Lockup-free D-cache access: a miss parks in an MSHR (merging with a fill
+// already under way for the block) instead of stalling the pipeline.
+// Returns 0 on a hit, 1 if the access now waits on a fill, and -1 if no
+// MSHR or target slot is free and MEM has to retry next cycle. A hit that
+// needed a page walk or more than a cycle returns -2 after setting up a
+// blocking stall for it.
+static int dcache_access_nonblocking(const Pipe_Op *in)
+{
+    uint64_t addr = phys(in->MEM_ADDRESS);
+    // A sectored L1D fills (and so tracks misses) a sector at a time
+    uint64_t block = addr & ~((uint64_t) data_cache->sector_size - 1);
+    int idx = mshr_find(&dcache_mshrs, block);
+    int blocked = idx >= 0 ? !mshr_can_merge(&dcache_mshrs, idx)
+                           : mshr_full(&dcache_mshrs) && !cache_probe(data_cache, addr);
+    if (blocked) {
+        dcache_mshrs.stat_full_stalls++;
+        return -1;
+    }
+
+    int dtlb_cycles = tlb_translate(dtlb, addr);
+    sdist_access(dsdist, addr);
+    int hit = cache_check(data_cache, addr);
+    int lookup = data_cache->lookup_cycles - 1;
+    if (hit) {
+        cache_train(data_cache, in->PC, addr, 1);
+        if (dtlb_cycles || lookup) {
+            DCACHE_MISS = 1;
+            DCACHE_MISS_ADDR = addr;
+            DCACHE_MISS_LATENCY = dtlb_cycles + lookup;
+            return -2;
+        }
+        return 0;
+    }
+    if (idx < 0) {
+        idx = mshr_alloc(&dcache_mshrs, block,
+                         dtlb_cycles + lookup + cache_miss_latency(data_cache, addr));
+    }
+    cache_train(data_cache, in->PC, addr, 0);
+    int dest = (in->LOAD && in->RT_REG != 31) ? (int) in->RT_REG : -1;
+    mshr_add_target(&dcache_mshrs, idx, dest, in->STORE ? store_bytes(in->INSTRUCTION) : 0);
+    printf("[MEM] D-cache MISS at addr 0x%lx under MSHR %d\n", in->MEM_ADDRESS, idx);
+    return 1;
+}
+
 void pipe_stage_mem()
 {
     printf("[MEM] DCACHE_MISS=%d, DCACHE_STALLED_THIS_CYCLE=%d, cycles_remaining=%d\n",
@@ -265,17 +1320,66 @@ void pipe_stage_mem()
         return; 
     }
 
+    int waiting_on_fill = 0;
+    int buffered = 0;
+
     
     if (DCACHE_MISS && DCACHE_MISS_CYCLES_REMAINING == 0) {
         printf("[MEM] D-cache MISS resolved at addr 0x%lx\n", DCACHE_MISS_ADDR);
-        cache_insert(data_cache, DCACHE_MISS_ADDR);
+        // A block still streaming in is installed by its fill buffer
+        if (!fillbuf_holds(&dcache_fill, data_cache, DCACHE_MISS_ADDR)) {
+            cache_insert(data_cache, DCACHE_MISS_ADDR);
+        }
         DCACHE_MISS = 0;
-    } else if (!DCACHE_MISS) {
-        int hit = cache_check(data_cache, in.MEM_ADDRESS);
-        if (!hit && (in.LOAD || in.STORE)) {
-            printf("[MEM] D-cache MISS at addr 0x%lx, starting 50 cycle stall\n", in.MEM_ADDRESS);
+    } else if (!DCACHE_MISS && (in.LOAD || in.STORE) && store_buffer.num_entries > 0 &&
+               (buffered = store_buffer_access(&in)) != 0) {
+        if (buffered < 0) {
+            STORE_STALL = 1;
+            return;
+        }
+    } else if (!DCACHE_MISS && (in.LOAD || in.STORE) && dcache_mshrs.num_entries > 0) {
+        waiting_on_fill = dcache_access_nonblocking(&in);
+        if (waiting_on_fill == -2) {
+            return;
+        }
+        if (waiting_on_fill < 0) {
+            MSHR_STALL = 1;
+            return;
+        }
+    } else if (!DCACHE_MISS && (in.LOAD || in.STORE)) {
+        uint64_t addr = phys(in.MEM_ADDRESS);
+        int dtlb_cycles = tlb_translate(dtlb, addr);
+        sdist_access(dsdist, addr);
+        // Words of a block still streaming in come from the fill buffer, or
+        // are waited for; a store waits for the line to be installed
+        int bytes = in.STORE ? data_cache->sector_size : load_bytes(in.INSTRUCTION);
+        int fill_wait = fillbuf_wait(&dcache_fill, data_cache, addr, bytes);
+        int hit = fill_wait < 0 ? cache_check(data_cache, addr) : fill_wait == 0;
+        int lookup = fill_wait < 0 ? data_cache->lookup_cycles - 1 : 0;
+        if (!hit || dtlb_cycles) {
+            // A TLB miss stalls like a cache miss, for the walk plus any fill
+            DCACHE_MISS = 1;
+            DCACHE_MISS_ADDR = addr;
+            DCACHE_MISS_LATENCY = hit ? dtlb_cycles + lookup
+                : fill_wait > 0 ? dtlb_cycles + fill_wait
+                : l1_fill(&dcache_fill, data_cache, addr, bytes, dtlb_cycles + lookup);
+            cache_train(data_cache, in.PC, addr, hit || fill_wait >= 0);
+            // Another hardware thread can have the pipeline meanwhile
+            if (thread_miss(in.PC, addr, DCACHE_MISS_LATENCY)) {
+                DCACHE_MISS = 0;
+                MEM_to_WB_CURRENT.NOP = 1;
+                return;
+            }
+            printf("[MEM] D-cache MISS at addr 0x%lx, starting %d cycle stall\n",
+                   in.MEM_ADDRESS, DCACHE_MISS_LATENCY);
+            return;
+        }
+        cache_train(data_cache, in.PC, addr, 1);
+        if (lookup) {
+            // A hit slower than the MEM cycle holds MEM like a short miss
             DCACHE_MISS = 1;
-            DCACHE_MISS_ADDR = in.MEM_ADDRESS;
+            DCACHE_MISS_ADDR = addr;
+            DCACHE_MISS_LATENCY = lookup;
             return;
         }
     }
@@ -337,9 +1441,33 @@ void pipe_stage_mem()
         default:
             break;
     }
+
+    // Store data goes through (or dirties) the D-cache; writeback traffic is
+    // counted but absorbed by a write buffer, so it adds no stall. A store
+    // waiting on an MSHR is written when its block arrives.
+    if (in.STORE && !waiting_on_fill && !buffered) {
+        cache_write(data_cache, phys(in.MEM_ADDRESS), store_bytes(in.INSTRUCTION));
+    }
 }
 
 
+static int sets_flags(const Pipe_Op *op)
+{
+    if (op->NOP) return 0;
+    switch (op->INSTRUCTION) {
+        case ADDS_IMM:
+        case ADDS_EXT:
+        case SUBS_IMM:
+        case SUBS_EXT:
+        case CMP_IMM:
+        case CMP_EXT:
+        case ANDS_SHIFTR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
 void pipe_stage_execute()
 {
     memset(&EX_to_MEM_CURRENT, 0, sizeof(EX_to_MEM_CURRENT));
@@ -360,6 +1488,12 @@ void pipe_stage_execute()
 
     uint64_t branch_pc = in.PC;
 
+    // Conditional branches see the flags of the nearest older instruction
+    // that sets them: forwarded from MEM, or already committed by WB when
+    // a bubble or another instruction sits in between
+    int flag_n = sets_flags(&EX_to_MEM_PREV) ? EX_to_MEM_PREV.FLAG_N : pipe.FLAG_N;
+    int flag_z = sets_flags(&EX_to_MEM_PREV) ? EX_to_MEM_PREV.FLAG_Z : pipe.FLAG_Z;
+
 
     // Forward RN_VAL
     if (in.READS_RN) {
@@ -565,32 +1699,32 @@ void pipe_stage_execute()
 
         case BEQ:
             EX_to_MEM_CURRENT.BR_TARGET = branch_pc + (in.IMM << 2);
-            EX_to_MEM_CURRENT.BR_TAKEN  = EX_to_MEM_PREV.FLAG_Z;
+            EX_to_MEM_CURRENT.BR_TAKEN  = flag_z;
             break;
 
         case BNE:
             EX_to_MEM_CURRENT.BR_TARGET = branch_pc + (in.IMM << 2);
-            EX_to_MEM_CURRENT.BR_TAKEN  = !EX_to_MEM_PREV.FLAG_Z;
+            EX_to_MEM_CURRENT.BR_TAKEN  = !flag_z;
             break;
 
         case BLT:
             EX_to_MEM_CURRENT.BR_TARGET = branch_pc + (in.IMM << 2);
-            EX_to_MEM_CURRENT.BR_TAKEN  = EX_to_MEM_PREV.FLAG_N;
+            EX_to_MEM_CURRENT.BR_TAKEN  = flag_n;
             break;
 
         case BLE:
             EX_to_MEM_CURRENT.BR_TARGET = branch_pc + (in.IMM << 2);
-            EX_to_MEM_CURRENT.BR_TAKEN  = EX_to_MEM_PREV.FLAG_N || EX_to_MEM_PREV.FLAG_Z;
+            EX_to_MEM_CURRENT.BR_TAKEN  = flag_n || flag_z;
             break;
 
         case BGT:
             EX_to_MEM_CURRENT.BR_TARGET = branch_pc + (in.IMM << 2);
-            EX_to_MEM_CURRENT.BR_TAKEN  = !EX_to_MEM_PREV.FLAG_N && !EX_to_MEM_PREV.FLAG_Z;
+            EX_to_MEM_CURRENT.BR_TAKEN  = !flag_n && !flag_z;
             break;
 
         case BGE:
             EX_to_MEM_CURRENT.BR_TARGET = branch_pc + (in.IMM << 2);
-            EX_to_MEM_CURRENT.BR_TAKEN  = !EX_to_MEM_PREV.FLAG_N;
+            EX_to_MEM_CURRENT.BR_TAKEN  = !flag_n;
             break;
 
         case CBNZ:
@@ -1051,6 +2185,26 @@ void pipe_stage_decode()
         }
     }
 
+    // Registers still waiting on a non-blocking D-cache fill can be neither
+    // read nor overwritten until the fill lands
+    if (dcache_mshrs.pending_regs) {
+        uint32_t uses = 0;
+        if (DE_to_EX_CURRENT.READS_RN) uses |= 1u << DE_to_EX_CURRENT.RN_REG;
+        if (DE_to_EX_CURRENT.READS_RM) uses |= 1u << DE_to_EX_CURRENT.RM_REG;
+        if (DE_to_EX_CURRENT.WRITES_REG) uses |= 1u << DE_to_EX_CURRENT.RD_REG;
+        if (DE_to_EX_CURRENT.LOAD || DE_to_EX_CURRENT.STORE ||
+            DE_to_EX_CURRENT.INSTRUCTION == CBZ || DE_to_EX_CURRENT.INSTRUCTION == CBNZ) {
+            uses |= 1u << DE_to_EX_CURRENT.RT_REG;
+        }
+        if (uses & dcache_mshrs.pending_regs & ~(1u << 31)) {
+            printf("[DECODE] Waiting on D-cache fill, stalling pipeline\n");
+            memset(&DE_to_EX_CURRENT, 0, sizeof(DE_to_EX_CURRENT));
+            DE_to_EX_CURRENT.NOP = 1;
+            FILL_STALL = 1;
+            return;
+        }
+    }
+
         if (DE_to_EX_PREV.LOAD && !DE_to_EX_PREV.NOP) {
         int load_target = DE_to_EX_PREV.RT_REG;
         int need_stall = 0;
@@ -1092,6 +2246,19 @@ void pipe_stage_decode()
     }
 }
 
+// The fetch miss has run its course: its block goes in, unless the miss
+// was cancelled, was a slow hit, or is streaming in through the fill buffer
+static void icache_miss_resolve(void)
+{
+    if (!ICACHE_MISS_CANCELLED && !ICACHE_MISS_HIT &&
+        !fillbuf_holds(&icache_fill, instruction_cache, phys(ICACHE_MISS_PC))) {
+        printf("[FETCH] -> MISS resolved, inserting block for PC=0x%lx\n", ICACHE_MISS_PC);
+        cache_insert(instruction_cache, phys(ICACHE_MISS_PC));
+    }
+    ICACHE_MISS = 0;
+    ICACHE_MISS_CYCLES_REMAINING = 0;
+}
+
 void pipe_stage_fetch()
 {
     Pipe_Op fetched_instruction;
@@ -1099,7 +2266,21 @@ void pipe_stage_fetch()
     fetched_instruction.NOP = 1;
     fetched_instruction.INSTRUCTION = UNKNOWN;
 
-    if (HLT_FLAG) {
+    if (HLT_FLAG || SWITCH_PENDING) {
+        if (SWITCH_PENDING) {
+            // The PC stays put while the slice drains, whatever a fetch a
+            // stall threw away predicted; a branch redirect still lands
+            if (!CLEAR_DE) {
+                NEXT_PC = pipe.PC;
+            }
+            // An outstanding miss still fills, so even a slice shorter
+            // than a miss gets its block in
+            if (ICACHE_MISS && ICACHE_MISS_CYCLES_REMAINING > 1) {
+                ICACHE_MISS_CYCLES_REMAINING--;
+            } else if (ICACHE_MISS) {
+                icache_miss_resolve();
+            }
+        }
         IF_to_DE_CURRENT = fetched_instruction;
         return;
     }
@@ -1110,13 +2291,15 @@ void pipe_stage_fetch()
         fetch_pc = NEXT_PC;
     }
 
-    uint64_t block_mask = ~((uint64_t)instruction_cache->block_size - 1);
+    // Misses fill a sector at a time (the whole block when unsectored)
+    uint64_t block_mask = ~((uint64_t)instruction_cache->sector_size - 1);
     uint64_t miss_block  = ICACHE_MISS_PC & block_mask;
     uint64_t redirect_block = fetch_pc & block_mask;  // Use fetch_pc, not NEXT_PC
 
     printf("[FETCH] PC=0x%lx, MISS=%d, MISS_PC=0x%lx, CYCLES=%d, CLEAR_DE=%d\n",
            pipe.PC, ICACHE_MISS, ICACHE_MISS_PC, ICACHE_MISS_CYCLES_REMAINING, CLEAR_DE);
 
+    int resolved = 0;
     if (ICACHE_MISS) {
         // Check for cancellation due to branch redirect to different block
         if (CLEAR_DE && (miss_block != redirect_block)) {
@@ -1137,31 +2320,46 @@ void pipe_stage_fetch()
         }
         
         // Counter is 0 or 1 - miss resolves this cycle
-        // Insert block into cache (unless cancelled)
-        if (!ICACHE_MISS_CANCELLED) {
-            printf("[FETCH] -> MISS resolved, inserting block for PC=0x%lx\n", ICACHE_MISS_PC);
-            cache_insert(instruction_cache, ICACHE_MISS_PC);
-        }
-        ICACHE_MISS = 0;
-        ICACHE_MISS_CYCLES_REMAINING = 0;
+        resolved = 1;
+        icache_miss_resolve();
         // Fall through to fetch
     }
 
-    // Normal cache access
-    int icache_hit = cache_check(instruction_cache, fetch_pc);
-    printf("[FETCH] -> cache_check(0x%lx) = %s\n", fetch_pc, icache_hit ? "HIT" : "MISS");
-    
-    if (!icache_hit) {
-        printf("[FETCH] -> starting new miss at 0x%lx\n", fetch_pc);
-        ICACHE_MISS = 1;
-        ICACHE_MISS_PC = fetch_pc;
-        ICACHE_MISS_CYCLES_REMAINING = 50;
-        ICACHE_MISS_CANCELLED = 0;
-        IF_to_DE_CURRENT = fetched_instruction;  // NOP
-        return;
+    // Normal cache access, unless a slow hit has just waited out its lookup
+    uint64_t fetch_addr = phys(fetch_pc);
+    if (!resolved || !ICACHE_MISS_HIT) {
+        int itlb_cycles = tlb_translate(itlb, fetch_addr);
+        sdist_access(isdist, fetch_addr);
+        // Sequential fetches use words already in the fill buffer
+        int fill_wait = fillbuf_wait(&icache_fill, instruction_cache, fetch_addr, 4);
+        int icache_hit = fill_wait < 0 ? cache_check(instruction_cache, fetch_addr) : fill_wait == 0;
+        // A miss that just resolved has paid for its lookup already
+        int lookup = fill_wait < 0 && !resolved ? instruction_cache->lookup_cycles - 1 : 0;
+        printf("[FETCH] -> cache_check(0x%lx) = %s\n", fetch_pc, icache_hit ? "HIT" : "MISS");
+
+        // An I-TLB miss waits out the page walk the same way as a cache
+        // miss, and so does a hit slower than a cycle
+        if (!icache_hit || itlb_cycles || lookup) {
+            printf("[FETCH] -> starting new miss at 0x%lx\n", fetch_pc);
+            ICACHE_MISS = 1;
+            ICACHE_MISS_PC = fetch_pc;
+            ICACHE_MISS_CYCLES_REMAINING = icache_hit ? itlb_cycles + lookup
+                : fill_wait > 0 ? itlb_cycles + fill_wait
+                : l1_fill(&icache_fill, instruction_cache, fetch_addr, 4, itlb_cycles + lookup);
+            ICACHE_MISS_CANCELLED = 0;
+            ICACHE_MISS_HIT = icache_hit && lookup;
+            // Fetch resumes here, whatever a fetch a stall threw away predicted
+            NEXT_PC = fetch_pc;
+            if (!icache_hit && fill_wait < 0) {
+                cache_train(instruction_cache, fetch_pc, fetch_addr, 0);
+            }
+            IF_to_DE_CURRENT = fetched_instruction;  // NOP
+            return;
+        }
     }
 
     // Cache hit - fetch instruction
+    cache_train(instruction_cache, fetch_pc, fetch_addr, 1);
     uint32_t raw_inst = mem_read_32(fetch_pc);
     fetched_instruction.raw_instruction = raw_inst;
     fetched_instruction.PC = fetch_pc;
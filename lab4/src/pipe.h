@@ -8,9 +8,343 @@
 #define _PIPE_H_
 
 #include "bp.h"
+#include "cache.h"
+#include "mshr.h"
+#include "storebuf.h"
+#include "fillbuf.h"
+#include "tlb.h"
+#include "sdist.h"
 #include "shell.h"
 #include "stdbool.h"
 #include <limits.h>
+#include <stdio.h>
+
+/* L1 cache geometry (sets, ways, block bytes). Sets and block size must be
+ * powers of two. Override at build time, e.g.
+ *   make CFLAGS="-DDCACHE_SETS=512 -DDCACHE_BLOCK=64" */
+#ifndef ICACHE_SETS
+#define ICACHE_SETS  64
+#endif
+#ifndef ICACHE_WAYS
+#define ICACHE_WAYS  4
+#endif
+#ifndef ICACHE_BLOCK
+#define ICACHE_BLOCK 32
+#endif
+#ifndef DCACHE_SETS
+#define DCACHE_SETS  256
+#endif
+#ifndef DCACHE_WAYS
+#define DCACHE_WAYS  8
+#endif
+#ifndef DCACHE_BLOCK
+#define DCACHE_BLOCK 32
+#endif
+
+/* Levels behind both L1s. A level with 0 sets is left out; the L3 is only
+ * used when there is an L2. Inclusion is one of the cache_inclusion_t
+ * values. MEM_CYCLES is charged when the last level misses. */
+#ifndef L2_SETS
+#define L2_SETS        0
+#endif
+#ifndef L2_WAYS
+#define L2_WAYS        8
+#endif
+#ifndef L2_BLOCK
+#define L2_BLOCK       32
+#endif
+#ifndef L2_HIT_CYCLES
+#define L2_HIT_CYCLES  10
+#endif
+#ifndef L2_INCLUSION
+#define L2_INCLUSION   CACHE_INCLUSIVE
+#endif
+#ifndef L3_SETS
+#define L3_SETS        0
+#endif
+#ifndef L3_WAYS
+#define L3_WAYS        16
+#endif
+#ifndef L3_BLOCK
+#define L3_BLOCK       32
+#endif
+#ifndef L3_HIT_CYCLES
+#define L3_HIT_CYCLES  30
+#endif
+#ifndef L3_INCLUSION
+#define L3_INCLUSION   CACHE_NON_INCLUSIVE
+#endif
+#ifndef MEM_CYCLES
+#define MEM_CYCLES     50
+#endif
+
+/* DRAM behind the last level (0 channels = flat MEM_CYCLES). Geometry must
+ * be powers of two; timings are in CPU cycles. */
+#ifndef DRAM_CHANNELS
+#define DRAM_CHANNELS     0
+#endif
+#ifndef DRAM_RANKS
+#define DRAM_RANKS        1
+#endif
+#ifndef DRAM_BANKS
+#define DRAM_BANKS        8
+#endif
+#ifndef DRAM_ROW_SIZE
+#define DRAM_ROW_SIZE     2048
+#endif
+#ifndef DRAM_PAGE_POLICY
+#define DRAM_PAGE_POLICY  DRAM_OPEN_PAGE
+#endif
+#ifndef DRAM_SCHEDULER
+#define DRAM_SCHEDULER    DRAM_FR_FCFS
+#endif
+#ifndef DRAM_TRCD
+#define DRAM_TRCD         15
+#endif
+#ifndef DRAM_TRP
+#define DRAM_TRP          15
+#endif
+#ifndef DRAM_TCAS
+#define DRAM_TCAS         15
+#endif
+#ifndef DRAM_TBURST
+#define DRAM_TBURST       4
+#endif
+#ifndef DRAM_CTRL_CYCLES
+#define DRAM_CTRL_CYCLES  10
+#endif
+
+/* Replacement policy per level, one of the repl_policy_t values */
+#ifndef ICACHE_REPL
+#define ICACHE_REPL    REPL_LRU
+#endif
+#ifndef DCACHE_REPL
+#define DCACHE_REPL    REPL_LRU
+#endif
+#ifndef L2_REPL
+#define L2_REPL        REPL_LRU
+#endif
+#ifndef L3_REPL
+#define L3_REPL        REPL_LRU
+#endif
+
+/* Write policy per level, CACHE_WRITE_THROUGH or CACHE_WRITE_BACK */
+#ifndef DCACHE_WRITE_POLICY
+#define DCACHE_WRITE_POLICY CACHE_WRITE_THROUGH
+#endif
+#ifndef L2_WRITE_POLICY
+#define L2_WRITE_POLICY     CACHE_WRITE_BACK
+#endif
+#ifndef L3_WRITE_POLICY
+#define L3_WRITE_POLICY     CACHE_WRITE_BACK
+#endif
+
+/* Sectors per line (1 = whole-line fills). A sectored level keeps one tag
+ * per line and a valid bit per sector, and a miss fetches only its sector */
+#ifndef ICACHE_SECTORS
+#define ICACHE_SECTORS 1
+#endif
+#ifndef DCACHE_SECTORS
+#define DCACHE_SECTORS 1
+#endif
+#ifndef L2_SECTORS
+#define L2_SECTORS     1
+#endif
+#ifndef L3_SECTORS
+#define L3_SECTORS     1
+#endif
+
+/* Set index function per level, one of the cache_index_t values: the low
+ * block-number bits, XOR-folded high bits, a prime modulus, or skewed (a
+ * different hash in every way; LRU only, not with way prediction or
+ * compression) */
+#ifndef ICACHE_INDEX
+#define ICACHE_INDEX   CACHE_INDEX_MODULO
+#endif
+#ifndef DCACHE_INDEX
+#define DCACHE_INDEX   CACHE_INDEX_MODULO
+#endif
+#ifndef L2_INDEX
+#define L2_INDEX       CACHE_INDEX_MODULO
+#endif
+#ifndef L3_INDEX
+#define L3_INDEX       CACHE_INDEX_MODULO
+#endif
+
+/* L1 hit time in cycles (1 = within the fetch or MEM cycle, anything more
+ * stalls the stage) and MRU way prediction per L1 (0 = off): a hit in the
+ * predicted way takes one cycle, any other lookup a cycle more than the
+ * hit time */
+#ifndef ICACHE_HIT_CYCLES
+#define ICACHE_HIT_CYCLES    1
+#endif
+#ifndef DCACHE_HIT_CYCLES
+#define DCACHE_HIT_CYCLES    1
+#endif
+#ifndef ICACHE_WAY_PREDICT
+#define ICACHE_WAY_PREDICT   0
+#endif
+#ifndef DCACHE_WAY_PREDICT
+#define DCACHE_WAY_PREDICT   0
+#endif
+
+/* Compressed L1D (0 = off): every physical way gets DCACHE_COMPRESS_TAGS
+ * tags, and blocks are stored BDI-compressed in the set's DCACHE_WAYS
+ * blocks of data. A hit on a compressed block takes DCACHE_DECOMPRESS_CYCLES
+ * more. */
+#ifndef DCACHE_COMPRESS
+#define DCACHE_COMPRESS           0
+#endif
+#ifndef DCACHE_COMPRESS_TAGS
+#define DCACHE_COMPRESS_TAGS      2
+#endif
+#ifndef DCACHE_DECOMPRESS_CYCLES
+#define DCACHE_DECOMPRESS_CYCLES  1
+#endif
+
+/* Prefetcher per L1, one of the prefetch_policy_t values, with its degree
+ * (blocks per trigger) and distance (how far ahead) */
+#ifndef ICACHE_PREFETCH
+#define ICACHE_PREFETCH     PF_NONE
+#endif
+#ifndef ICACHE_PF_DEGREE
+#define ICACHE_PF_DEGREE    1
+#endif
+#ifndef ICACHE_PF_DISTANCE
+#define ICACHE_PF_DISTANCE  1
+#endif
+#ifndef DCACHE_PREFETCH
+#define DCACHE_PREFETCH     PF_NONE
+#endif
+#ifndef DCACHE_PF_DEGREE
+#define DCACHE_PF_DEGREE    1
+#endif
+#ifndef DCACHE_PF_DISTANCE
+#define DCACHE_PF_DISTANCE  1
+#endif
+
+/* Fully associative victim buffer behind the L1D (0 entries = none) */
+#ifndef DCACHE_VICTIM_ENTRIES
+#define DCACHE_VICTIM_ENTRIES    0
+#endif
+#ifndef DCACHE_VICTIM_HIT_CYCLES
+#define DCACHE_VICTIM_HIT_CYCLES 1
+#endif
+
+/* Instruction and data TLBs (0 entries = no TLB, translation is free).
+ * A miss walks the page table, either TLB_WALK_LEVEL_CYCLES per level or,
+ * with TLB_WALK_VIA_DCACHE, by reading each entry through the L1D. */
+#ifndef ITLB_ENTRIES
+#define ITLB_ENTRIES          0
+#endif
+#ifndef ITLB_WAYS
+#define ITLB_WAYS             4
+#endif
+#ifndef ITLB_PAGE_SIZE
+#define ITLB_PAGE_SIZE        4096
+#endif
+#ifndef DTLB_ENTRIES
+#define DTLB_ENTRIES          0
+#endif
+#ifndef DTLB_WAYS
+#define DTLB_WAYS             4
+#endif
+#ifndef DTLB_PAGE_SIZE
+#define DTLB_PAGE_SIZE        4096
+#endif
+#ifndef TLB_WALK_LEVEL_CYCLES
+#define TLB_WALK_LEVEL_CYCLES 20
+#endif
+#ifndef TLB_WALK_VIA_DCACHE
+#define TLB_WALK_VIA_DCACHE   0
+#endif
+
+/* Stack-distance profiling of the I- and D-side access streams (0 = off);
+ * the "curves" command writes the miss-ratio curves as CSV */
+#ifndef SDIST_PROFILE
+#define SDIST_PROFILE       0
+#endif
+
+/* Three-C classification of every cache's misses (0 = off); the stats
+ * show the split and the "heatmap" command shows conflicts per set */
+#ifndef MISS_CLASSIFY
+#define MISS_CLASSIFY       0
+#endif
+
+/* Multicore: one core per program file, at most MAX_CORES. A miss that
+ * another core's L1D owns (Modified or Exclusive) is served from that
+ * cache in COH_TRANSFER_CYCLES */
+#ifndef MAX_CORES
+#define MAX_CORES           8
+#endif
+#ifndef COH_TRANSFER_CYCLES
+#define COH_TRANSFER_CYCLES 20
+#endif
+
+/* With CORE_THREADS=1 (shell.h) the cores run on host threads of their
+ * own and meet every CORE_QUANTUM cycles. A quantum of 1 steps them in
+ * turn and matches the single-threaded run exactly; a larger one lets
+ * them run apart, with coherence actions on another core's L1s delivered
+ * at its next cycle */
+#ifndef CORE_QUANTUM
+#define CORE_QUANTUM        1
+#endif
+
+/* Time slicing: with TIME_SLICE > 0 the program files become processes
+ * sharing one core instead of a core each, at most MAX_PROCESSES. Each has
+ * its own registers and address space; when its TIME_SLICE cycles are up,
+ * fetch stops, the pipeline drains and the next process runs. The L1s, TLBs
+ * and BTB tell processes apart by address space, or with SWITCH_FLUSH=1 are
+ * flushed at every switch */
+#ifndef TIME_SLICE
+#define TIME_SLICE          0
+#endif
+#ifndef MAX_PROCESSES
+#define MAX_PROCESSES       8
+#endif
+#ifndef SWITCH_FLUSH
+#define SWITCH_FLUSH        0
+#endif
+
+/* Hardware multithreading: with HW_THREADS > 0 the program files become
+ * up to that many hardware threads of one core, each with its own
+ * registers, flags, global history and address space, sharing the
+ * pipeline, caches, TLBs, PHT and BTB. A load that misses the (blocking)
+ * D-cache switches its thread out, squashing it and everything behind it,
+ * and the next ready thread fetches while the fill completes; the load is
+ * replayed when its thread comes back */
+#ifndef HW_THREADS
+#define HW_THREADS          0
+#endif
+
+/* Lockup-free D-cache: number of MSHRs (0 = blocking) and accesses each
+ * one can hold */
+#ifndef DCACHE_MSHRS
+#define DCACHE_MSHRS        0
+#endif
+#ifndef DCACHE_MSHR_TARGETS
+#define DCACHE_MSHR_TARGETS 4
+#endif
+
+/* Store buffer in front of the D-cache: entries (0 = none, stores write
+ * the cache from MEM at no cost). Stores to a buffered block coalesce,
+ * entries drain one at a time at the cost of the write, MEM stalls when
+ * it is full, and loads it fully covers are forwarded from it */
+#ifndef STORE_BUFFER_ENTRIES
+#define STORE_BUFFER_ENTRIES 0
+#endif
+
+/* Critical-word-first fills into both L1s: cycles between the words of a
+ * block after the first (0 = a block arrives all at once), and the bus
+ * word in bytes. The missing word arrives first and the rest stream into
+ * a fill buffer, which serves accesses to the words already in until the
+ * line is installed */
+#ifndef FILL_BEAT_CYCLES
+#define FILL_BEAT_CYCLES 0
+#endif
+#ifndef FILL_WORD
+#define FILL_WORD 8
+#endif
 
 // struct bp_t;
 /* Represents the current state of the pipeline. */
@@ -112,17 +446,87 @@ typedef struct Pipe_Op {
 
 } Pipe_Op;
 
+/* Every piece of pipeline bookkeeping pipe.c keeps in globals, gathered
+ * so a run can be frozen and resumed (see snapshot.c). Cache and branch
+ * predictor contents are not included, only the pointers to them. */
+typedef struct Pipe_Context {
+    Pipe_State pipe;
+
+    Pipe_Op IF_to_DE_CURRENT, DE_to_EX_CURRENT, EX_to_MEM_CURRENT, MEM_to_WB_CURRENT;
+    Pipe_Op IF_to_DE_PREV, DE_to_EX_PREV, EX_to_MEM_PREV, MEM_to_WB_PREV;
+
+    Pipe_Op SAVED_INSTRUCTION;
+    int INSTRUCTION_SAVED;
+    int UPDATE_EX, UPDATE_EX_NEXT;
+    int HLT_FLAG, HLT_NEXT;
+    int RUN_BIT;
+    uint64_t NEXT_PC;
+    int CLEAR_DE;
+    int BRANCH, BRANCH_NEXT;
 
-extern int RUN_BIT;
+    int DCACHE_MISS;
+    int DCACHE_MISS_LATENCY;
+    int DCACHE_MISS_CYCLES_REMAINING;
+    uint64_t DCACHE_MISS_ADDR;
+    Pipe_Op DCACHE_STALLED_OP;
+    cache_t *instruction_cache;
+    cache_t *data_cache;
+
+    int ICACHE_MISS;
+    int ICACHE_MISS_CYCLES_REMAINING;
+    uint64_t ICACHE_MISS_PC;
+    int ICACHE_MISS_CANCELLED;
+    int ICACHE_MISS_HIT;
+    int ICACHE_MISS_CANCEL_DELAY;
+    int DCACHE_STALLED_THIS_CYCLE;
+    int LOAD_STALL;
+    mshr_file_t dcache_mshrs;
+    int MSHR_STALL;
+    int FILL_STALL;
+    storebuf_t store_buffer;
+    int STORE_STALL;
+    fillbuf_t icache_fill, dcache_fill;
+    tlb_t *itlb;
+    tlb_t *dtlb;
+    dram_t *dram;
+    sdist_t *isdist;
+    sdist_t *dsdist;
+} Pipe_Context;
+
+
+extern CORE_LOCAL int RUN_BIT;
 
 /* global variable -- pipeline state */
-extern Pipe_State pipe;
+extern CORE_LOCAL Pipe_State pipe;
 
 /* called during simulator startup */
 void pipe_init();
 
+/* multicore: cores beyond the first, and which one the globals hold */
+extern int num_cores;
+void pipe_add_core();
+void pipe_switch_core(int core);
+void pipe_set_entry(uint64_t pc);
+
+/* time slicing or hardware threads: processes beyond the first, whose
+ * registers and memory the globals hold, and which one is running */
+extern int num_processes;
+extern int running_process;
+void pipe_add_process();
+void pipe_switch_process(int process);
+
+/* copy the pipeline globals out to / back in from a context */
+void pipe_save(Pipe_Context *ctx);
+void pipe_restore(const Pipe_Context *ctx);
+
+/* print statistics for every cache level */
+void pipe_print_stats(FILE *out);
+void pipe_write_curves(FILE *out);
+void pipe_print_heatmaps(FILE *out);
+
 /* this function calls the others */
 void pipe_cycle();
+int pipe_run(int cycles);
 
 /* each of these functions implements one stage of the pipeline */
 void pipe_stage_fetch();
@@ -0,0 +1,202 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "prefetch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+prefetcher_t *prefetch_new(prefetch_policy_t policy, int degree, int distance)
+{
+    if ((int) policy < 0 || policy > PF_STREAM) {
+        fprintf(stderr, "Unsupported prefetcher: %d\n", (int) policy);
+        exit(1);
+    }
+    if (degree < 1 || degree > PF_MAX_DEGREE) {
+        fprintf(stderr, "Unsupported prefetch degree: %d (1 to %d)\n", degree, PF_MAX_DEGREE);
+        exit(1);
+    }
+    if (distance < 1) {
+        fprintf(stderr, "Unsupported prefetch distance: %d\n", distance);
+        exit(1);
+    }
+
+    prefetcher_t *pf = (prefetcher_t *) calloc(1, sizeof(prefetcher_t));
+    if (!pf) {
+        fprintf(stderr, "Failed to allocate memory for prefetcher\n");
+        exit(1);
+    }
+    pf->policy = policy;
+    pf->degree = degree;
+    pf->distance = distance;
+    return pf;
+}
+
+const char *prefetch_name(prefetch_policy_t policy)
+{
+    static const char *names[] = { "none", "next-line", "stride", "stream" };
+    return names[policy];
+}
+
+/************************* next-line *************************/
+
+static int next_line_train(prefetcher_t *pf, uint64_t addr, int block_bits, uint64_t *out)
+{
+    uint64_t block = addr >> block_bits;
+    for (int i = 0; i < pf->degree; i++) {
+        out[i] = (block + pf->distance + i) << block_bits;
+    }
+    return pf->degree;
+}
+
+/************************ PC stride **************************/
+// Once a load PC repeats the same stride twice, run distance strides ahead.
+
+static int stride_train(prefetcher_t *pf, uint64_t pc, uint64_t addr, uint64_t *out)
+{
+    pf_stride_entry_t *e = &pf->stride[(pc >> 2) % PF_STRIDE_ENTRIES];
+    if (e->pc != pc) {
+        e->pc = pc;
+        e->last_addr = addr;
+        e->stride = 0;
+        e->confidence = 0;
+        return 0;
+    }
+
+    int64_t stride = (int64_t) (addr - e->last_addr);
+    e->last_addr = addr;
+    if (stride == 0) return 0;
+    if (stride == e->stride) {
+        if (e->confidence < 3) e->confidence++;
+    } else {
+        if (e->confidence > 0) e->confidence--;
+        if (e->confidence == 0) e->stride = stride;
+        return 0;
+    }
+    if (e->confidence < 2) return 0;
+
+    for (int i = 0; i < pf->degree; i++) {
+        out[i] = addr + (uint64_t) (e->stride * (pf->distance + i));
+    }
+    return pf->degree;
+}
+
+/************************** stream ***************************/
+// Misses near a tracked head extend that stream; two in the same direction
+// confirm it, after which every step runs distance blocks ahead of the head.
+
+static int stream_train(prefetcher_t *pf, uint64_t addr, int block_bits, int hit, uint64_t *out)
+{
+    uint64_t block = addr >> block_bits;
+    pf->clock++;
+
+    pf_stream_t *s = NULL;
+    for (int i = 0; i < PF_STREAMS; i++) {
+        pf_stream_t *t = &pf->stream[i];
+        if (!t->valid) continue;
+        int64_t delta = (int64_t) (block - t->head);
+        if (delta != 0 && delta >= -PF_STREAM_WINDOW && delta <= PF_STREAM_WINDOW &&
+            (t->direction == 0 || (delta > 0) == (t->direction > 0))) {
+            s = t;
+            break;
+        }
+    }
+
+    if (!s) {
+        // Only misses start streams; take a free slot or the least recently used
+        if (hit) return 0;
+        s = &pf->stream[0];
+        for (int i = 0; i < PF_STREAMS; i++) {
+            if (!pf->stream[i].valid) { s = &pf->stream[i]; break; }
+            if (pf->stream[i].last_use < s->last_use) s = &pf->stream[i];
+        }
+        memset(s, 0, sizeof(*s));
+        s->valid = 1;
+        s->head = block;
+        s->last_use = pf->clock;
+        return 0;
+    }
+
+    int direction = block > s->head ? 1 : -1;
+    if (s->direction == direction) {
+        if (s->confidence < 3) s->confidence++;
+    } else {
+        s->direction = direction;
+        s->confidence = 1;
+    }
+    s->head = block;
+    s->last_use = pf->clock;
+    if (s->confidence < 2) return 0;
+
+    for (int i = 0; i < pf->degree; i++) {
+        out[i] = (block + (uint64_t) (int64_t) (direction * (pf->distance + i))) << block_bits;
+    }
+    return pf->degree;
+}
+
+// Feed one demand access; fills out (room for PF_MAX_DEGREE addresses) with
+// what to fetch and returns how many
+int prefetch_train(prefetcher_t *pf, uint64_t pc, uint64_t addr, int block_bits,
+                   int hit, uint64_t *out)
+{
+    if (!pf) return 0;
+    switch (pf->policy) {
+        case PF_NEXT_LINE: return next_line_train(pf, addr, block_bits, out);
+        case PF_STRIDE:    return stride_train(pf, pc, addr, out);
+        case PF_STREAM:    return stream_train(pf, addr, block_bits, hit, out);
+        default:           return 0;
+    }
+}
+
+int prefetch_queue_find(const prefetcher_t *pf, uint64_t block_addr)
+{
+    for (int i = 0; i < PF_QUEUE; i++) {
+        if (pf->queue[i].valid && pf->queue[i].block_addr == block_addr) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int prefetch_free_slot(const prefetcher_t *pf)
+{
+    for (int i = 0; i < PF_QUEUE; i++) {
+        if (!pf->queue[i].valid) return i;
+    }
+    return -1;
+}
+
+int prefetch_queue_full(const prefetcher_t *pf)
+{
+    return prefetch_free_slot(pf) < 0;
+}
+
+// Caller checks prefetch_queue_full() first
+void prefetch_queue_push(prefetcher_t *pf, uint64_t block_addr, int latency)
+{
+    pf_request_t *r = &pf->queue[prefetch_free_slot(pf)];
+    r->valid = 1;
+    r->block_addr = block_addr;
+    r->cycles_remaining = latency;
+    pf->stat_issued++;
+}
+
+void prefetch_print_stats(FILE *out, const prefetcher_t *pf, uint64_t demand_misses)
+{
+    if (!pf || pf->policy == PF_NONE) return;
+    uint64_t covered = pf->stat_useful + pf->stat_late;
+    fprintf(out, "  prefetch (%s, degree %d, distance %d): issued %" PRIu64 ", useful %" PRIu64
+            ", late %" PRIu64 ", useless %" PRIu64 ", dropped %" PRIu64 "\n",
+            prefetch_name(pf->policy), pf->degree, pf->distance, pf->stat_issued,
+            pf->stat_useful, pf->stat_late, pf->stat_useless, pf->stat_dropped);
+    // Coverage: share of would-be misses removed or shortened; the useful
+    // hits would all have missed without the prefetcher
+    fprintf(out, "  accuracy %.2f%%, coverage %.2f%%, timeliness %.2f%%\n",
+            pf->stat_issued ? 100.0 * covered / pf->stat_issued : 0.0,
+            pf->stat_useful + demand_misses ? 100.0 * covered / (pf->stat_useful + demand_misses) : 0.0,
+            covered ? 100.0 * pf->stat_useful / covered : 0.0);
+}
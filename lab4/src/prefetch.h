@@ -0,0 +1,80 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Hardware prefetchers. A cache with a prefetcher feeds it every demand
+ * access (PC, address, hit or miss); the prefetcher answers with
+ * candidate addresses, which the cache fetches in the background through a
+ * small queue of in-flight prefetches. All state lives in fixed-size
+ * arrays so a prefetcher can be copied with its cache.
+ */
+#ifndef _PREFETCH_H_
+#define _PREFETCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    PF_NONE = 0,
+    PF_NEXT_LINE,   /* the blocks following every access */
+    PF_STRIDE,      /* per-PC constant stride detection */
+    PF_STREAM       /* several ascending or descending miss streams */
+} prefetch_policy_t;
+
+#define PF_STRIDE_ENTRIES 64     /* PC-indexed, direct mapped */
+#define PF_STREAMS        8
+#define PF_STREAM_WINDOW  16     /* blocks a miss may be from a stream's head */
+#define PF_QUEUE          16     /* prefetches in flight */
+#define PF_MAX_DEGREE     8
+
+typedef struct pf_stride_entry {
+    uint64_t pc;
+    uint64_t last_addr;
+    int64_t stride;              /* in bytes */
+    int confidence;              /* 0..3, prefetch at 2 and above */
+} pf_stride_entry_t;
+
+typedef struct pf_stream {
+    int valid;
+    uint64_t head;               /* last block seen in the stream */
+    int direction;               /* +1 / -1, 0 until the second miss */
+    int confidence;
+    uint64_t last_use;
+} pf_stream_t;
+
+typedef struct pf_request {
+    int valid;
+    uint64_t block_addr;
+    int cycles_remaining;
+} pf_request_t;
+
+typedef struct prefetcher {
+    prefetch_policy_t policy;
+    int degree;                  /* blocks per trigger */
+    int distance;                /* how far ahead, in strides */
+
+    pf_stride_entry_t stride[PF_STRIDE_ENTRIES];
+    pf_stream_t stream[PF_STREAMS];
+    uint64_t clock;
+
+    pf_request_t queue[PF_QUEUE];
+
+    /* statistics */
+    uint64_t stat_issued;        /* prefetches sent to the next level */
+    uint64_t stat_useful;        /* prefetched blocks hit before eviction */
+    uint64_t stat_late;          /* demand misses on a block still in flight */
+    uint64_t stat_useless;       /* prefetched blocks evicted unused */
+    uint64_t stat_dropped;       /* candidates lost to a full queue */
+} prefetcher_t;
+
+prefetcher_t *prefetch_new(prefetch_policy_t policy, int degree, int distance);
+const char *prefetch_name(prefetch_policy_t policy);
+int prefetch_train(prefetcher_t *pf, uint64_t pc, uint64_t addr, int block_bits,
+                   int hit, uint64_t *out);
+int prefetch_queue_find(const prefetcher_t *pf, uint64_t block_addr);
+int prefetch_queue_full(const prefetcher_t *pf);
+void prefetch_queue_push(prefetcher_t *pf, uint64_t block_addr, int latency);
+void prefetch_print_stats(FILE *out, const prefetcher_t *pf, uint64_t demand_misses);
+
+#endif
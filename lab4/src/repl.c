@@ -0,0 +1,270 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "repl.h"
+#include <stddef.h>
+
+/* Per-way fields are 2^wshift bits wide (at most 16), so they never
+ * straddle a word and all index math is shifts and masks */
+static inline uint64_t field_get(const uint64_t *meta, int idx, int wshift)
+{
+    int per_word_shift = 6 - wshift;
+    int shift = (idx & ((1 << per_word_shift) - 1)) << wshift;
+    return (meta[idx >> per_word_shift] >> shift) & ((1ULL << (1 << wshift)) - 1);
+}
+
+static inline void field_set(uint64_t *meta, int idx, int wshift, uint64_t value)
+{
+    int per_word_shift = 6 - wshift;
+    int shift = (idx & ((1 << per_word_shift) - 1)) << wshift;
+    uint64_t mask = ((1ULL << (1 << wshift)) - 1) << shift;
+    uint64_t *word = &meta[idx >> per_word_shift];
+    *word = (*word & ~mask) | ((value << shift) & mask);
+}
+
+uint64_t repl_rand(uint64_t *rng)
+{
+    // xorshift64*
+    uint64_t x = *rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *rng = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+int repl_words(const repl_ops_t *ops, int ways)
+{
+    int bits = ops->set_bits(ways);
+    int words = (bits + 63) / 64;
+    return words > 0 ? words : 1;
+}
+
+/************************** true LRU **************************/
+// Ages form a permutation of 0..ways-1; 0 is most recently used.
+
+// log2 of the age field width: ceil(log2(ways)) bits rounded up to 1, 2, 4, 8 or 16
+static inline int lru_wshift(int ways)
+{
+    int bits = ways > 2 ? 32 - __builtin_clz((unsigned) (ways - 1)) : 1;
+    return bits <= 1 ? 0 : 32 - __builtin_clz((unsigned) (bits - 1));
+}
+
+static int lru_set_bits(int ways)
+{
+    return ways << lru_wshift(ways);
+}
+
+static void lru_init(uint64_t *meta, int ways)
+{
+    int wshift = lru_wshift(ways);
+    for (int i = 0; i < ways; i++) {
+        field_set(meta, i, wshift, i);
+    }
+}
+
+static void lru_touch(uint64_t *meta, int ways, int way)
+{
+    int wshift = lru_wshift(ways);
+    int per_word = 64 >> wshift;
+    uint64_t mask = (1ULL << (1 << wshift)) - 1;
+    uint64_t age = field_get(meta, way, wshift);
+    if (age == 0) return;   // already most recently used
+    // Age everything younger than way a word at a time; a + 1 <= age never
+    // carries into the neighbouring field
+    for (int base = 0; base < ways; base += per_word) {
+        uint64_t word = meta[base >> (6 - wshift)];
+        uint64_t aged = word;
+        int n = ways - base < per_word ? ways - base : per_word;
+        for (int j = 0; j < n; j++) {
+            int shift = j << wshift;
+            aged += (uint64_t) (((word >> shift) & mask) < age) << shift;
+        }
+        meta[base >> (6 - wshift)] = aged;
+    }
+    field_set(meta, way, wshift, 0);
+}
+
+static void lru_fill(uint64_t *meta, int ways, int way, uint64_t *rng)
+{
+    (void) rng;
+    lru_touch(meta, ways, way);
+}
+
+static int lru_victim(uint64_t *meta, int ways, uint64_t *rng)
+{
+    (void) rng;
+    int wshift = lru_wshift(ways);
+    for (int i = 0; i < ways; i++) {
+        if (field_get(meta, i, wshift) == (uint64_t) (ways - 1)) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/************************* tree-PLRU **************************/
+// Heap-ordered node bits; 0 sends the victim search left, 1 right.
+
+static int plru_set_bits(int ways)
+{
+    int leaves = 1;
+    while (leaves < ways) leaves <<= 1;
+    return leaves - 1;
+}
+
+static void plru_init(uint64_t *meta, int ways)
+{
+    int words = (plru_set_bits(ways) + 63) / 64;
+    for (int i = 0; i < words; i++) {
+        meta[i] = 0;
+    }
+}
+
+static void plru_touch(uint64_t *meta, int ways, int way)
+{
+    int node = 1, lo = 0, hi = ways;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (way < mid) {
+            field_set(meta, node - 1, 0, 1);   // point away, to the right
+            node = 2 * node;
+            hi = mid;
+        } else {
+            field_set(meta, node - 1, 0, 0);
+            node = 2 * node + 1;
+            lo = mid;
+        }
+    }
+}
+
+static void plru_fill(uint64_t *meta, int ways, int way, uint64_t *rng)
+{
+    (void) rng;
+    plru_touch(meta, ways, way);
+}
+
+static int plru_victim(uint64_t *meta, int ways, uint64_t *rng)
+{
+    (void) rng;
+    int node = 1, lo = 0, hi = ways;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (field_get(meta, node - 1, 0) == 0) {
+            node = 2 * node;
+            hi = mid;
+        } else {
+            node = 2 * node + 1;
+            lo = mid;
+        }
+    }
+    return lo;
+}
+
+/*************************** RRIP ****************************/
+// 2-bit re-reference prediction values; 3 = distant, evicted first.
+
+#define RRPV_SHIFT   1          /* 2-bit fields */
+#define RRPV_MAX     3
+#define BRRIP_LONG_1_IN 32
+
+static int rrip_set_bits(int ways)
+{
+    return ways << RRPV_SHIFT;
+}
+
+static void rrip_init(uint64_t *meta, int ways)
+{
+    for (int i = 0; i < ways; i++) {
+        field_set(meta, i, RRPV_SHIFT, RRPV_MAX);
+    }
+}
+
+static void rrip_touch(uint64_t *meta, int ways, int way)
+{
+    (void) ways;
+    field_set(meta, way, RRPV_SHIFT, 0);
+}
+
+static void srrip_fill(uint64_t *meta, int ways, int way, uint64_t *rng)
+{
+    (void) ways;
+    (void) rng;
+    field_set(meta, way, RRPV_SHIFT, RRPV_MAX - 1);
+}
+
+static void brrip_fill(uint64_t *meta, int ways, int way, uint64_t *rng)
+{
+    (void) ways;
+    uint64_t rrpv = (repl_rand(rng) % BRRIP_LONG_1_IN == 0) ? RRPV_MAX - 1 : RRPV_MAX;
+    field_set(meta, way, RRPV_SHIFT, rrpv);
+}
+
+static int rrip_victim(uint64_t *meta, int ways, uint64_t *rng)
+{
+    (void) rng;
+    for (;;) {
+        for (int i = 0; i < ways; i++) {
+            if (field_get(meta, i, RRPV_SHIFT) == RRPV_MAX) {
+                return i;
+            }
+        }
+        // Nobody is distant yet: age everyone and look again
+        for (int i = 0; i < ways; i++) {
+            field_set(meta, i, RRPV_SHIFT, field_get(meta, i, RRPV_SHIFT) + 1);
+        }
+    }
+}
+
+/************************** random ***************************/
+
+static int random_set_bits(int ways)
+{
+    (void) ways;
+    return 0;
+}
+
+static void random_init(uint64_t *meta, int ways)
+{
+    (void) meta;
+    (void) ways;
+}
+
+static void random_touch(uint64_t *meta, int ways, int way)
+{
+    (void) meta;
+    (void) ways;
+    (void) way;
+}
+
+static void random_fill(uint64_t *meta, int ways, int way, uint64_t *rng)
+{
+    (void) meta;
+    (void) ways;
+    (void) way;
+    (void) rng;
+}
+
+static int random_victim(uint64_t *meta, int ways, uint64_t *rng)
+{
+    (void) meta;
+    return (int) (repl_rand(rng) % (uint64_t) ways);
+}
+
+static const repl_ops_t repl_table[] = {
+    [REPL_LRU]    = { "LRU",    lru_set_bits,    lru_init,    lru_touch,    lru_fill,    lru_victim },
+    [REPL_PLRU]   = { "PLRU",   plru_set_bits,   plru_init,   plru_touch,   plru_fill,   plru_victim },
+    [REPL_SRRIP]  = { "SRRIP",  rrip_set_bits,   rrip_init,   rrip_touch,   srrip_fill,  rrip_victim },
+    [REPL_BRRIP]  = { "BRRIP",  rrip_set_bits,   rrip_init,   rrip_touch,   brrip_fill,  rrip_victim },
+    [REPL_RANDOM] = { "random", random_set_bits, random_init, random_touch, random_fill, random_victim },
+};
+
+const repl_ops_t *repl_get_ops(repl_policy_t policy)
+{
+    if ((int) policy < 0 || policy > REPL_RANDOM) return NULL;
+    return &repl_table[policy];
+}
@@ -0,0 +1,37 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Cache replacement policies. Each policy keeps its state for one set in a
+ * small bitfield (a few uint64_t words) owned by the cache; the cache always
+ * prefers an invalid way and only asks the policy for a victim when the set
+ * is full.
+ */
+#ifndef _REPL_H_
+#define _REPL_H_
+
+#include <stdint.h>
+
+typedef enum {
+    REPL_LRU = 0,   /* true LRU, one age field per way */
+    REPL_PLRU,      /* tree pseudo-LRU, ways - 1 bits (power-of-two ways) */
+    REPL_SRRIP,     /* static RRIP, 2-bit re-reference prediction per way */
+    REPL_BRRIP,     /* bimodal RRIP, inserts at distant re-reference mostly */
+    REPL_RANDOM     /* no state */
+} repl_policy_t;
+
+typedef struct repl_ops {
+    const char *name;
+    int (*set_bits)(int ways);                            /* state bits per set */
+    void (*init)(uint64_t *meta, int ways);
+    void (*touch)(uint64_t *meta, int ways, int way);     /* on a hit */
+    void (*fill)(uint64_t *meta, int ways, int way, uint64_t *rng);
+    int (*victim)(uint64_t *meta, int ways, uint64_t *rng);
+} repl_ops_t;
+
+const repl_ops_t *repl_get_ops(repl_policy_t policy);
+int repl_words(const repl_ops_t *ops, int ways);
+uint64_t repl_rand(uint64_t *rng);
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "sdist.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define SDIST_MIN_TABLE (1 << 12)
+#define SDIST_MIN_TREE  (1 << 16)
+
+static void *sdist_alloc(size_t bytes)
+{
+    void *p = calloc(1, bytes);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate memory for stack-distance profile\n");
+        exit(1);
+    }
+    return p;
+}
+
+sdist_t *sdist_new(const char *name, int block_size)
+{
+    if (block_size <= 0 || (block_size & (block_size - 1)) != 0) {
+        fprintf(stderr, "Unsupported %s profile block size: %d\n", name, block_size);
+        exit(1);
+    }
+
+    sdist_t *s = (sdist_t *) sdist_alloc(sizeof(sdist_t));
+    s->name = name;
+    s->block_size = block_size;
+    while ((1 << s->block_bits) < block_size) s->block_bits++;
+
+    s->table_size = SDIST_MIN_TABLE;
+    s->keys = (uint64_t *) sdist_alloc(s->table_size * sizeof(uint64_t));
+    s->times = (uint64_t *) sdist_alloc(s->table_size * sizeof(uint64_t));
+    s->tree_size = SDIST_MIN_TREE;
+    s->tree = (uint32_t *) sdist_alloc((s->tree_size + 1) * sizeof(uint32_t));
+    s->hist_size = SDIST_MIN_TABLE;
+    s->hist = (uint64_t *) sdist_alloc(s->hist_size * sizeof(uint64_t));
+    for (int k = 1; k <= SDIST_MAX_SET_BITS; k++) {
+        s->stacks[k] = (uint64_t *) sdist_alloc(((size_t) SDIST_MAX_WAYS << k) * sizeof(uint64_t));
+    }
+    return s;
+}
+
+void sdist_destroy(sdist_t *s)
+{
+    if (!s) return;
+    free(s->keys);
+    free(s->times);
+    free(s->tree);
+    free(s->hist);
+    for (int k = 1; k <= SDIST_MAX_SET_BITS; k++) {
+        free(s->stacks[k]);
+    }
+    free(s);
+}
+
+static void *sdist_copy_array(void *dst, const void *src, size_t bytes)
+{
+    dst = realloc(dst, bytes);
+    if (!dst) {
+        fprintf(stderr, "Failed to allocate memory for stack-distance profile\n");
+        exit(1);
+    }
+    return memcpy(dst, src, bytes);
+}
+
+// Copy the whole profile; dst's arrays are resized to match src
+void sdist_copy(sdist_t *dst, const sdist_t *src)
+{
+    if (!dst || !src) return;
+    dst->keys = sdist_copy_array(dst->keys, src->keys, src->table_size * sizeof(uint64_t));
+    dst->times = sdist_copy_array(dst->times, src->times, src->table_size * sizeof(uint64_t));
+    dst->tree = sdist_copy_array(dst->tree, src->tree, (src->tree_size + 1) * sizeof(uint32_t));
+    dst->hist = sdist_copy_array(dst->hist, src->hist, src->hist_size * sizeof(uint64_t));
+    for (int k = 1; k <= SDIST_MAX_SET_BITS; k++) {
+        memcpy(dst->stacks[k], src->stacks[k], ((size_t) SDIST_MAX_WAYS << k) * sizeof(uint64_t));
+    }
+    memcpy(dst->set_hist, src->set_hist, sizeof(src->set_hist));
+    dst->table_size = src->table_size;
+    dst->table_used = src->table_used;
+    dst->tree_size = src->tree_size;
+    dst->now = src->now;
+    dst->hist_size = src->hist_size;
+    dst->stat_accesses = src->stat_accesses;
+    dst->stat_cold = src->stat_cold;
+}
+
+sdist_t *sdist_clone(const sdist_t *src)
+{
+    if (!src) return NULL;
+    sdist_t *s = sdist_new(src->name, src->block_size);
+    sdist_copy(s, src);
+    return s;
+}
+
+/************************ block table *************************/
+
+static size_t sdist_slot(const sdist_t *s, uint64_t block)
+{
+    size_t mask = s->table_size - 1;
+    size_t i = (size_t) ((block * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    while (s->keys[i] && s->keys[i] != block + 1) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void sdist_grow_table(sdist_t *s)
+{
+    uint64_t *keys = s->keys, *times = s->times;
+    size_t old_size = s->table_size;
+
+    s->table_size *= 2;
+    s->keys = (uint64_t *) sdist_alloc(s->table_size * sizeof(uint64_t));
+    s->times = (uint64_t *) sdist_alloc(s->table_size * sizeof(uint64_t));
+    for (size_t i = 0; i < old_size; i++) {
+        if (!keys[i]) continue;
+        size_t slot = sdist_slot(s, keys[i] - 1);
+        s->keys[slot] = keys[i];
+        s->times[slot] = times[i];
+    }
+    free(keys);
+    free(times);
+}
+
+/************************ Fenwick tree ************************/
+
+static void sdist_tree_add(sdist_t *s, uint64_t t, int delta)
+{
+    for (size_t i = t; i <= s->tree_size; i += i & -i) {
+        s->tree[i] += (uint32_t) delta;
+    }
+}
+
+// Marks at times 1 .. t
+static size_t sdist_tree_prefix(const sdist_t *s, uint64_t t)
+{
+    size_t sum = 0;
+    for (size_t i = t; i > 0; i -= i & -i) {
+        sum += s->tree[i];
+    }
+    return sum;
+}
+
+// Out of timestamps: renumber every block's latest access 1 .. m in the
+// same order and rebuild the tree, leaving room for as many new accesses
+static void sdist_compact(sdist_t *s)
+{
+    size_t m = s->table_used;
+    uint64_t *slot_at = (uint64_t *) sdist_alloc((s->tree_size + 1) * sizeof(uint64_t));
+    for (size_t i = 0; i < s->table_size; i++) {
+        if (s->keys[i]) slot_at[s->times[i]] = i + 1;
+    }
+    uint64_t t = 0;
+    for (size_t old = 1; old <= s->tree_size; old++) {
+        if (slot_at[old]) s->times[slot_at[old] - 1] = ++t;
+    }
+    free(slot_at);
+
+    size_t size = SDIST_MIN_TREE;
+    while (size < 2 * m) size *= 2;
+    free(s->tree);
+    s->tree_size = size;
+    s->tree = (uint32_t *) sdist_alloc((size + 1) * sizeof(uint32_t));
+    for (size_t i = 1; i <= m; i++) {
+        s->tree[i] += 1;
+        size_t parent = i + (i & -i);
+        if (parent <= size) s->tree[parent] += s->tree[i];
+    }
+    for (size_t i = m + 1; i <= size; i++) {
+        size_t parent = i + (i & -i);
+        if (parent <= size) s->tree[parent] += s->tree[i];
+    }
+    s->now = m;
+}
+
+/************************** profiling *************************/
+
+static void sdist_hist_add(sdist_t *s, size_t d)
+{
+    if (d >= s->hist_size) {
+        size_t size = s->hist_size;
+        while (size <= d) size *= 2;
+        s->hist = (uint64_t *) realloc(s->hist, size * sizeof(uint64_t));
+        if (!s->hist) {
+            fprintf(stderr, "Failed to allocate memory for stack-distance profile\n");
+            exit(1);
+        }
+        memset(s->hist + s->hist_size, 0, (size - s->hist_size) * sizeof(uint64_t));
+        s->hist_size = size;
+    }
+    s->hist[d]++;
+}
+
+// Depth of block in its set's LRU stack for every number of sets, then
+// move it to the top
+static void sdist_set_access(sdist_t *s, uint64_t block)
+{
+    for (int k = 1; k <= SDIST_MAX_SET_BITS; k++) {
+        uint64_t *stack = s->stacks[k] + (block & ((1ULL << k) - 1)) * SDIST_MAX_WAYS;
+        int depth = 0;
+        while (depth < SDIST_MAX_WAYS && stack[depth] != block + 1) depth++;
+        s->set_hist[k][depth]++;
+        int shift = depth < SDIST_MAX_WAYS ? depth : SDIST_MAX_WAYS - 1;
+        memmove(stack + 1, stack, (size_t) shift * sizeof(uint64_t));
+        stack[0] = block + 1;
+    }
+}
+
+void sdist_access(sdist_t *s, uint64_t addr)
+{
+    if (!s) return;
+    uint64_t block = addr >> s->block_bits;
+    s->stat_accesses++;
+    sdist_set_access(s, block);
+
+    if (s->now == s->tree_size) sdist_compact(s);
+    uint64_t now = ++s->now;
+
+    size_t slot = sdist_slot(s, block);
+    if (s->keys[slot]) {
+        // Every distinct block holds one mark; those after last were touched since
+        uint64_t last = s->times[slot];
+        sdist_hist_add(s, s->table_used - sdist_tree_prefix(s, last));
+        sdist_tree_add(s, last, -1);
+    } else {
+        s->stat_cold++;
+        s->keys[slot] = block + 1;
+        s->table_used++;
+    }
+    s->times[slot] = now;
+    sdist_tree_add(s, now, 1);
+
+    if (s->table_used * 2 > s->table_size) sdist_grow_table(s);
+}
+
+// One row per fully associative capacity at which the curve steps (sets = 1,
+// ways = blocks), then every set-associative geometry
+void sdist_write_csv(FILE *out, const sdist_t *s, int header)
+{
+    if (header) {
+        fprintf(out, "side,sets,ways,block_size,capacity_bytes,accesses,misses,miss_ratio\n");
+    }
+    if (!s) return;
+
+    uint64_t hits = 0;
+    for (size_t d = 0; d < s->hist_size; d++) {
+        if (!s->hist[d]) continue;
+        hits += s->hist[d];
+        uint64_t misses = s->stat_accesses - hits;
+        fprintf(out, "%s,1,%zu,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.6f\n",
+                s->name, d + 1, s->block_size, (uint64_t) (d + 1) * s->block_size,
+                s->stat_accesses, misses, (double) misses / s->stat_accesses);
+    }
+
+    for (int k = 1; k <= SDIST_MAX_SET_BITS; k++) {
+        uint64_t misses = s->set_hist[k][SDIST_MAX_WAYS];
+        uint64_t row_misses[SDIST_MAX_WAYS + 1];
+        for (int ways = SDIST_MAX_WAYS; ways >= 1; ways--) {
+            row_misses[ways] = misses;
+            misses += s->set_hist[k][ways - 1];
+        }
+        for (int ways = 1; ways <= SDIST_MAX_WAYS; ways++) {
+            fprintf(out, "%s,%d,%d,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.6f\n",
+                    s->name, 1 << k, ways, s->block_size,
+                    ((uint64_t) ways << k) * s->block_size, s->stat_accesses, row_misses[ways],
+                    s->stat_accesses ? (double) row_misses[ways] / s->stat_accesses : 0.0);
+        }
+    }
+}
+
+void sdist_print_stats(FILE *out, const sdist_t *s)
+{
+    if (!s) return;
+    fprintf(out, "%s reuse profile: accesses %" PRIu64 ", distinct %d B blocks %zu (%" PRIu64 " KB)\n",
+            s->name, s->stat_accesses, s->block_size, s->table_used,
+            (uint64_t) s->table_used * s->block_size / 1024);
+
+    // Fully associative LRU miss ratio at a few power-of-two sizes
+    fprintf(out, "  LRU miss ratio, fully associative:");
+    uint64_t hits = 0;
+    size_t d = 0;
+    for (uint64_t kb = 1; kb <= 1024; kb *= 4) {
+        uint64_t blocks = kb * 1024 / s->block_size;
+        for (; d < s->hist_size && d < blocks; d++) {
+            hits += s->hist[d];
+        }
+        fprintf(out, " %" PRIu64 " KB %.2f%%", kb,
+                s->stat_accesses ? 100.0 * (s->stat_accesses - hits) / s->stat_accesses : 0.0);
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,63 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Stack-distance profiling (Mattson et al.). One pass over an access
+ * stream yields the LRU miss ratio of every cache size at once: an access
+ * hits in a fully associative LRU cache of C blocks exactly when fewer
+ * than C distinct blocks were touched since its previous use. Distances
+ * are counted with a Fenwick tree over access times, in which each block
+ * marks only its latest access, so a lookup is O(log n). Set-associative
+ * curves come from a bounded LRU stack per set for every power-of-two
+ * number of sets up to 2^SDIST_MAX_SET_BITS.
+ */
+#ifndef _SDIST_H_
+#define _SDIST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#define SDIST_MAX_SET_BITS 12    /* set-associative curves for 2 .. 4096 sets */
+#define SDIST_MAX_WAYS     16    /* and 1 .. 16 ways */
+
+typedef struct sdist {
+    const char *name;
+    int block_size;
+    int block_bits;
+
+    /* block -> time of its latest access, open addressing; keys hold block + 1 */
+    uint64_t *keys;
+    uint64_t *times;
+    size_t table_size, table_used;
+
+    /* Fenwick tree over times 1 .. tree_size, one mark per distinct block */
+    uint32_t *tree;
+    size_t tree_size;
+    uint64_t now;
+
+    /* hist[d]: reuses with d distinct blocks in between */
+    uint64_t *hist;
+    size_t hist_size;
+
+    /* per number of sets 2^k, the SDIST_MAX_WAYS most recent blocks of
+     * each set (block + 1, most recent first) and the reuse depth histogram,
+     * whose last bucket counts deeper reuses and first touches */
+    uint64_t *stacks[SDIST_MAX_SET_BITS + 1];
+    uint64_t set_hist[SDIST_MAX_SET_BITS + 1][SDIST_MAX_WAYS + 1];
+
+    /* statistics */
+    uint64_t stat_accesses;
+    uint64_t stat_cold;          /* first touches of a block */
+} sdist_t;
+
+sdist_t *sdist_new(const char *name, int block_size);
+void sdist_destroy(sdist_t *s);
+void sdist_copy(sdist_t *dst, const sdist_t *src);
+sdist_t *sdist_clone(const sdist_t *src);
+void sdist_access(sdist_t *s, uint64_t addr);
+void sdist_write_csv(FILE *out, const sdist_t *s, int header);
+void sdist_print_stats(FILE *out, const sdist_t *s);
+
+#endif
@@ -20,12 +20,14 @@
 
 #include "shell.h"
 #include "pipe.h"
+#include "snapshot.h"
 
 /***************************************************************/
 /* Statistics.                                                 */
 /***************************************************************/
 
-uint32_t stat_cycles = 0, stat_inst_retire = 0, stat_inst_fetch = 0;
+uint32_t stat_cycles = 0, stat_inst_fetch = 0;
+CORE_LOCAL uint32_t stat_inst_retire = 0;
 uint32_t stat_squash = 0;
 
 /***************************************************************/
@@ -39,18 +41,15 @@ uint32_t stat_squash = 0;
 #define MEM_STACK_START 0xfffffffc
 #define MEM_STACK_SIZE  0x00100000
 
-typedef struct {
-    uint64_t start, size;
-    uint8_t *mem;
-} mem_region_t;
+/* each core's program gets its own slice of the text region */
+#define CORE_TEXT_SIZE  0x00010000
 
 /* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
+mem_region_t MEM_REGIONS[MEM_NREGIONS] = {
     { MEM_TEXT_START, MEM_TEXT_SIZE, NULL },
     { MEM_DATA_START, MEM_DATA_SIZE, NULL },
     { MEM_STACK_START, MEM_STACK_SIZE, NULL },
 };
-#define MEM_NREGIONS (sizeof(MEM_REGIONS)/sizeof(mem_region_t))
 
 
 
@@ -118,23 +117,15 @@ void help() {
   printf("mdump low high         -  dump memory from low to high      \n");
   printf("rdump                  -  dump the register & bus values    \n");
   printf("input reg_no reg_value - set GPR reg_no to reg_value  \n");
+  printf("stats                  -  dump cache statistics             \n");
+  printf("curves file            -  write LRU miss-ratio curves (CSV) \n");
+  printf("heatmap                -  show conflict misses per cache set\n");
+  printf("snapshot               -  freeze memory and machine state  \n");
+  printf("restore                -  reset to the last snapshot       \n");
   printf("?                      -  display this help menu            \n");
   printf("quit                   -  exit the program                  \n\n");
 }
 
-/***************************************************************/
-/*                                                             */
-/* Procedure : cycle                                           */
-/*                                                             */
-/* Purpose   : Execute a cycle                                 */
-/*                                                             */
-/***************************************************************/
-void cycle() {                                                
-  pipe_cycle();
-
-  stat_cycles++;
-}
-
 /***************************************************************/
 /*                                                             */
 /* Procedure : run n                                           */
@@ -151,12 +142,10 @@ void run(int num_cycles) {
   }
 
   printf("Simulating for %d cycles...\n\n", num_cycles);
-  for (i = 0; i < num_cycles; i++) {
-    if (!RUN_BIT) {
-	    printf("Simulator halted\n\n");
-	    break;
-    }
-    cycle();
+  i = pipe_run(num_cycles);
+  stat_cycles += i;
+  if (i < num_cycles) {
+    printf("Simulator halted\n\n");
   }
 }
 
@@ -175,7 +164,7 @@ void go() {
 
   printf("Simulating...\n\n");
   while (RUN_BIT)
-    cycle();
+    stat_cycles += pipe_run(INT_MAX);
   printf("Simulator halted\n\n");
 }
 /***************************************************************/ 
@@ -212,17 +201,27 @@ void mdump(FILE * dumpsim_file, int start, int stop) {
 /*                                                             */
 /***************************************************************/
 void rdump(FILE * dumpsim_file) {                               
-  int k; 
+  int k, core;
 
   printf("\nCurrent register/bus values :\n");
   printf("-------------------------------------\n");
   printf("Instruction Retired : %u\n", stat_inst_retire);
-  printf("PC                : 0x%" PRIx64 "\n", pipe.PC);
-  printf("Registers:\n");
-  for (k = 0; k < ARM_REGS; k++)
-    printf("X%d: 0x%" PRIx64 "\n", k, pipe.REGS[k]);
-  printf("FLAG_N: %d\n", pipe.FLAG_N);
-  printf("FLAG_Z: %d\n", pipe.FLAG_Z);
+  for (core = 0; core < num_cores * num_processes; core++) {
+    pipe_switch_core(core % num_cores);
+    pipe_switch_process(core / num_cores);
+    if (num_cores > 1)
+      printf("Core %d:\n", core);
+    if (num_processes > 1)
+      printf("%s %d:\n", HW_THREADS > 0 ? "Thread" : "Process", core);
+    printf("PC                : 0x%" PRIx64 "\n", pipe.PC);
+    printf("Registers:\n");
+    for (k = 0; k < ARM_REGS; k++)
+      printf("X%d: 0x%" PRIx64 "\n", k, pipe.REGS[k]);
+    printf("FLAG_N: %d\n", pipe.FLAG_N);
+    printf("FLAG_Z: %d\n", pipe.FLAG_Z);
+  }
+  pipe_switch_core(0);
+  pipe_switch_process(running_process);
   printf("No. of Cycles: %d\n", stat_cycles);
   printf("\n");
 
@@ -230,16 +229,29 @@ void rdump(FILE * dumpsim_file) {
   fprintf(dumpsim_file, "\nCurrent register/bus values :\n");
   fprintf(dumpsim_file, "-------------------------------------\n");
   fprintf(dumpsim_file, "Instruction Retired : %u\n", stat_inst_retire);
-  fprintf(dumpsim_file, "PC                : 0x%" PRIx64 "\n", pipe.PC);
-  fprintf(dumpsim_file, "Registers:\n");
-  for (k = 0; k < ARM_REGS; k++)
-    fprintf(dumpsim_file, "X%d: 0x%" PRIx64 "\n", k, pipe.REGS[k]);
-  fprintf(dumpsim_file, "FLAG_N: %d\n", pipe.FLAG_N);
-  fprintf(dumpsim_file, "FLAG_Z: %d\n", pipe.FLAG_Z);
+  for (core = 0; core < num_cores * num_processes; core++) {
+    pipe_switch_core(core % num_cores);
+    pipe_switch_process(core / num_cores);
+    if (num_cores > 1)
+      fprintf(dumpsim_file, "Core %d:\n", core);
+    if (num_processes > 1)
+      fprintf(dumpsim_file, "%s %d:\n", HW_THREADS > 0 ? "Thread" : "Process", core);
+    fprintf(dumpsim_file, "PC                : 0x%" PRIx64 "\n", pipe.PC);
+    fprintf(dumpsim_file, "Registers:\n");
+    for (k = 0; k < ARM_REGS; k++)
+      fprintf(dumpsim_file, "X%d: 0x%" PRIx64 "\n", k, pipe.REGS[k]);
+    fprintf(dumpsim_file, "FLAG_N: %d\n", pipe.FLAG_N);
+    fprintf(dumpsim_file, "FLAG_Z: %d\n", pipe.FLAG_Z);
+  }
+  pipe_switch_core(0);
+  pipe_switch_process(running_process);
   fprintf(dumpsim_file, "No. of Cycles: %d\n", stat_cycles);
   fprintf(dumpsim_file, "\n");
 }
 
+/* snapshot taken by the last "snapshot" command */
+static snapshot_t *current_snapshot = NULL;
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : get_command                                     */
@@ -248,7 +260,8 @@ void rdump(FILE * dumpsim_file) {
 /*                                                             */
 /***************************************************************/
 void get_command(FILE * dumpsim_file) {                         
-  char buffer[20];
+  char buffer[20], path[256];
+  FILE *curves_file;
   int start, stop, cycles;
   int register_no;
   int64_t register_value;
@@ -287,12 +300,48 @@ void get_command(FILE * dumpsim_file) {
   case 'r':
     if (buffer[1] == 'd' || buffer[1] == 'D')
 	    rdump(dumpsim_file);
+    else if (buffer[1] == 'e' || buffer[1] == 'E') {
+	    if (!current_snapshot) {
+	        printf("No snapshot to restore\n\n");
+	        break;
+	    }
+	    snapshot_restore(current_snapshot);
+	    printf("Restored snapshot\n\n");
+    }
     else {
 	    if (scanf("%d", &cycles) != 1) break;
 	    run(cycles);
     }
     break;
 
+  case 'C':
+  case 'c':
+    if (scanf("%255s", path) != 1)
+        break;
+    if (!SDIST_PROFILE) {
+        printf("Stack-distance profiling is off (build with -DSDIST_PROFILE=1)\n\n");
+        break;
+    }
+    curves_file = fopen(path, "w");
+    if (!curves_file) {
+        printf("Cannot write %s\n\n", path);
+        break;
+    }
+    pipe_write_curves(curves_file);
+    fclose(curves_file);
+    printf("Wrote miss-ratio curves to %s\n\n", path);
+    break;
+
+  case 'H':
+  case 'h':
+    if (!MISS_CLASSIFY) {
+        printf("Miss classification is off (build with -DMISS_CLASSIFY=1)\n\n");
+        break;
+    }
+    pipe_print_heatmaps(stdout);
+    pipe_print_heatmaps(dumpsim_file);
+    break;
+
   case 'I':
   case 'i':
    if (scanf("%i %" PRIx64, &register_no, &register_value) != 2)
@@ -300,6 +349,19 @@ void get_command(FILE * dumpsim_file) {
    pipe.REGS[register_no] = register_value;
    break;
 
+  case 'S':
+  case 's':
+    if (buffer[1] == 't' || buffer[1] == 'T') {
+        pipe_print_stats(stdout);
+        pipe_print_stats(dumpsim_file);
+        break;
+    }
+    snapshot_free(current_snapshot);
+    current_snapshot = snapshot_take();
+    if (current_snapshot)
+        printf("Snapshot taken\n\n");
+    break;
+
   default:
     printf("Invalid Command\n");
     break;
@@ -328,9 +390,13 @@ void init_memory() {
 /* Purpose   : Load program and service routines into mem.    */
 /*                                                            */
 /**************************************************************/
-void load_program(char *program_filename) {                   
+void load_program(char *program_filename, int index, int num_programs) {
   FILE * prog;
   int ii, word;
+  /* cores split the text region; time-sliced processes and hardware
+     threads each have an address space, and so a text region, of their own */
+  int slices = num_programs > 1 && TIME_SLICE == 0 && HW_THREADS == 0;
+  uint64_t text_start = MEM_TEXT_START + (slices ? (uint64_t) index * CORE_TEXT_SIZE : 0);
 
   /* Open program file. */
   prog = fopen(program_filename, "r");
@@ -344,7 +410,12 @@ void load_program(char *program_filename) {
   ii = 0;
   int bytes_read = EOF;
   while ((bytes_read=fscanf(prog, "%x\n", &word)) > 0) {
-    mem_write_32(MEM_TEXT_START + ii, word);
+    if (slices && ii == CORE_TEXT_SIZE) {
+      printf("Error: Program file %s does not fit in %d bytes\n",
+             program_filename, CORE_TEXT_SIZE);
+      exit(-1);
+    }
+    mem_write_32(text_start + ii, word);
     ii += 4;
   }
   if (bytes_read == 0) {
@@ -352,7 +423,9 @@ void load_program(char *program_filename) {
     exit(-1);
   }
 
-  pipe.PC = MEM_TEXT_START;
+  /* every core (or process, or thread) starts in its own program, with its number in X0 */
+  pipe_set_entry(text_start);
+  pipe.REGS[0] = index;
 
   printf("Read %d words from program into memory.\n\n", ii/4);
 }
@@ -370,9 +443,15 @@ void initialize(char *program_filename, int num_prog_files) {
   init_memory();
   pipe_init();
   for ( i = 0; i < num_prog_files; i++ ) {
-    load_program(program_filename);
+    if (i > 0 && (TIME_SLICE > 0 || HW_THREADS > 0))
+      pipe_add_process();
+    else if (i > 0)
+      pipe_add_core();
+    load_program(program_filename, i, num_prog_files);
     while(*program_filename++ != '\0');
   }
+  pipe_switch_core(0);
+  pipe_switch_process(0);
     
   RUN_BIT = 1;
 }
@@ -20,11 +20,33 @@
 
 #define ARM_REGS 32
 
+/* With CORE_THREADS=1 every core of a multicore run steps on a host thread
+ * of its own (see CORE_QUANTUM in pipe.h), so the state a core keeps in
+ * globals gets one copy per thread */
+#ifndef CORE_THREADS
+#define CORE_THREADS 0
+#endif
+#if CORE_THREADS
+#define CORE_LOCAL __thread
+#else
+#define CORE_LOCAL
+#endif
+
 /* only the cache touches these functions */
 uint32_t mem_read_32(uint64_t address);
 void     mem_write_32(uint64_t address, uint32_t value);
 
+/* guest memory regions; snapshot.c swaps their backing store */
+typedef struct {
+    uint64_t start, size;
+    uint8_t *mem;
+} mem_region_t;
+
+#define MEM_NREGIONS 3
+extern mem_region_t MEM_REGIONS[MEM_NREGIONS];
+
 /* statistics */
-extern uint32_t stat_cycles, stat_inst_retire, stat_inst_fetch, stat_squash;
+extern uint32_t stat_cycles, stat_inst_fetch, stat_squash;
+extern CORE_LOCAL uint32_t stat_inst_retire;
 
 #endif
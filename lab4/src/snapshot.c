@@ -0,0 +1,201 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+/* unistd.h declares pipe(), which clashes with the global pipeline state */
+#define pipe unistd_pipe
+#include <unistd.h>
+#undef pipe
+
+#include "snapshot.h"
+#include "shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* whether MEM_REGIONS[i].mem came from mmap (a clone) or from init_memory */
+static int region_mapped[MEM_NREGIONS];
+
+static void release_region(int i)
+{
+    if (!MEM_REGIONS[i].mem) return;
+    if (region_mapped[i]) {
+        munmap(MEM_REGIONS[i].mem, MEM_REGIONS[i].size);
+    } else {
+        free(MEM_REGIONS[i].mem);
+    }
+    MEM_REGIONS[i].mem = NULL;
+    region_mapped[i] = 0;
+}
+
+// Map a private (copy-on-write) view of the frozen region over the live one
+static int map_region(const snapshot_t *s, int i)
+{
+    void *view = mmap(NULL, MEM_REGIONS[i].size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, s->fd, (off_t) s->offset[i]);
+    if (view == MAP_FAILED) {
+        perror("snapshot: mmap");
+        return -1;
+    }
+    release_region(i);
+    MEM_REGIONS[i].mem = (uint8_t *) view;
+    region_mapped[i] = 1;
+    return 0;
+}
+
+static int write_all(int fd, const uint8_t *buf, uint64_t len, uint64_t off)
+{
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, (off_t) off);
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+snapshot_t *snapshot_take(void)
+{
+    if (num_cores > 1) {
+        fprintf(stderr, "Snapshots of a multicore machine are not supported\n");
+        return NULL;
+    }
+    if (num_processes > 1) {
+        fprintf(stderr, "Snapshots of time-sliced processes or hardware threads are not supported\n");
+        return NULL;
+    }
+
+    snapshot_t *s = (snapshot_t *) calloc(1, sizeof(snapshot_t));
+    if (!s) {
+        fprintf(stderr, "Failed to allocate memory for snapshot\n");
+        return NULL;
+    }
+
+    char path[] = "/tmp/armsim-snapshot-XXXXXX";
+    s->fd = mkstemp(path);
+    if (s->fd < 0) {
+        perror("snapshot: mkstemp");
+        free(s);
+        return NULL;
+    }
+    unlink(path);
+
+    // Lay the regions out back to back; region sizes are page multiples
+    uint64_t total = 0;
+    for (int i = 0; i < MEM_NREGIONS; i++) {
+        s->offset[i] = total;
+        total += MEM_REGIONS[i].size;
+    }
+    if (ftruncate(s->fd, (off_t) total) != 0) {
+        perror("snapshot: ftruncate");
+        close(s->fd);
+        free(s);
+        return NULL;
+    }
+    for (int i = 0; i < MEM_NREGIONS; i++) {
+        if (write_all(s->fd, MEM_REGIONS[i].mem, MEM_REGIONS[i].size, s->offset[i]) != 0) {
+            perror("snapshot: write");
+            close(s->fd);
+            free(s);
+            return NULL;
+        }
+    }
+
+    // The live machine becomes the first clone, so it shares pages as well
+    for (int i = 0; i < MEM_NREGIONS; i++) {
+        if (map_region(s, i) != 0) {
+            snapshot_free(s);
+            return NULL;
+        }
+    }
+
+    pipe_save(&s->ctx);
+    bp_copy(&s->bp, &bp);
+    s->instruction_cache = cache_clone(s->ctx.instruction_cache);
+    s->data_cache = cache_clone(s->ctx.data_cache);
+    cache_t *level = s->ctx.data_cache->next;
+    for (int i = 0; level && i < SNAPSHOT_MAX_LEVELS; i++, level = level->next) {
+        s->outer[i] = cache_clone(level);
+    }
+    s->itlb = tlb_clone(s->ctx.itlb);
+    s->dtlb = tlb_clone(s->ctx.dtlb);
+    s->dram = dram_clone(s->ctx.dram);
+    s->isdist = sdist_clone(s->ctx.isdist);
+    s->dsdist = sdist_clone(s->ctx.dsdist);
+
+    s->stat_cycles = stat_cycles;
+    s->stat_inst_retire = stat_inst_retire;
+    s->stat_inst_fetch = stat_inst_fetch;
+    s->stat_squash = stat_squash;
+
+    return s;
+}
+
+void snapshot_restore(const snapshot_t *s)
+{
+    if (!s) return;
+
+    for (int i = 0; i < MEM_NREGIONS; i++) {
+        if (map_region(s, i) != 0) {
+            fprintf(stderr, "Failed to restore memory region %d\n", i);
+            exit(1);
+        }
+    }
+
+    // Keep the live cache objects and copy the frozen contents into them
+    Pipe_Context live;
+    pipe_save(&live);
+
+    Pipe_Context ctx = s->ctx;
+    ctx.pipe.bp = live.pipe.bp;
+    ctx.instruction_cache = live.instruction_cache;
+    ctx.data_cache = live.data_cache;
+    ctx.itlb = live.itlb;
+    ctx.dtlb = live.dtlb;
+    ctx.dram = live.dram;
+    ctx.isdist = live.isdist;
+    ctx.dsdist = live.dsdist;
+    pipe_restore(&ctx);
+
+    bp_copy(&bp, &s->bp);
+    cache_copy(live.instruction_cache, s->instruction_cache);
+    cache_copy(live.data_cache, s->data_cache);
+    cache_t *level = live.data_cache->next;
+    for (int i = 0; level && i < SNAPSHOT_MAX_LEVELS; i++, level = level->next) {
+        cache_copy(level, s->outer[i]);
+    }
+    tlb_copy(live.itlb, s->itlb);
+    tlb_copy(live.dtlb, s->dtlb);
+    dram_copy(live.dram, s->dram);
+    sdist_copy(live.isdist, s->isdist);
+    sdist_copy(live.dsdist, s->dsdist);
+
+    stat_cycles = s->stat_cycles;
+    stat_inst_retire = s->stat_inst_retire;
+    stat_inst_fetch = s->stat_inst_fetch;
+    stat_squash = s->stat_squash;
+}
+
+void snapshot_free(snapshot_t *s)
+{
+    if (!s) return;
+    // Live regions may still be views of this snapshot; mappings outlive the fd
+    close(s->fd);
+    bp_free(&s->bp);
+    cache_destroy(s->instruction_cache);
+    cache_destroy(s->data_cache);
+    for (int i = 0; i < SNAPSHOT_MAX_LEVELS; i++) {
+        cache_destroy(s->outer[i]);
+    }
+    tlb_destroy(s->itlb);
+    tlb_destroy(s->dtlb);
+    dram_destroy(s->dram);
+    sdist_destroy(s->isdist);
+    sdist_destroy(s->dsdist);
+    free(s);
+}
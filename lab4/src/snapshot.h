@@ -0,0 +1,39 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Copy-on-write machine snapshots. A snapshot freezes guest memory in an
+ * unlinked backing file together with the pipeline, predictor and cache
+ * state. Restoring maps a private view of that file over each memory
+ * region, so every restored run shares the pages it never writes.
+ */
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "pipe.h"
+
+/* outer cache levels (L2, L3, ...) captured along with the L1s */
+#define SNAPSHOT_MAX_LEVELS 4
+
+typedef struct snapshot {
+    int fd;                              /* backing file for guest memory */
+    uint64_t offset[MEM_NREGIONS];       /* where each region lives in fd */
+
+    Pipe_Context ctx;
+    bp_t bp;                             /* private copy of predictor tables */
+    cache_t *instruction_cache;          /* private copies of cache state */
+    cache_t *data_cache;
+    cache_t *outer[SNAPSHOT_MAX_LEVELS]; /* levels behind the L1s, innermost first */
+    tlb_t *itlb, *dtlb;                  /* private copies of TLB state */
+    dram_t *dram;                        /* private copy of DRAM state */
+    sdist_t *isdist, *dsdist;            /* private copies of reuse profiles */
+
+    uint32_t stat_cycles, stat_inst_retire, stat_inst_fetch, stat_squash;
+} snapshot_t;
+
+snapshot_t *snapshot_take(void);
+void snapshot_restore(const snapshot_t *s);
+void snapshot_free(snapshot_t *s);
+
+#endif
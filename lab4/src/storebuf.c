@@ -0,0 +1,115 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "storebuf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+void storebuf_init(storebuf_t *b, int num_entries, int block_size)
+{
+    if (num_entries < 0 || num_entries > STOREBUF_MAX) {
+        fprintf(stderr, "Unsupported store buffer size: %d (at most %d)\n", num_entries, STOREBUF_MAX);
+        exit(1);
+    }
+    if (block_size > 64) {
+        fprintf(stderr, "Unsupported store buffer block size: %d (at most 64)\n", block_size);
+        exit(1);
+    }
+    memset(b, 0, sizeof(*b));
+    b->num_entries = num_entries;
+    b->block_size = block_size;
+    b->drain_cycles = -1;
+}
+
+// Bits of the block's byte mask covered by bytes at addr (clipped to the block)
+static uint64_t storebuf_mask(const storebuf_t *b, uint64_t addr, int bytes)
+{
+    int offset = (int) (addr & (uint64_t) (b->block_size - 1));
+    if (offset + bytes > b->block_size) bytes = b->block_size - offset;
+    uint64_t mask = bytes >= 64 ? ~0ULL : (1ULL << bytes) - 1;
+    return mask << offset;
+}
+
+static storebuf_entry_t *storebuf_find(storebuf_t *b, uint64_t block_addr)
+{
+    for (int i = 0; i < b->count; i++) {
+        storebuf_entry_t *e = &b->entry[(b->head + i) % b->num_entries];
+        if (e->block_addr == block_addr) return e;
+    }
+    return NULL;
+}
+
+// Take a store; returns 0 if the buffer is full and MEM has to retry
+int storebuf_put(storebuf_t *b, uint64_t addr, int bytes)
+{
+    uint64_t block_addr = addr & ~((uint64_t) b->block_size - 1);
+    uint64_t mask = storebuf_mask(b, addr, bytes);
+    storebuf_entry_t *e = storebuf_find(b, block_addr);
+    if (e) {
+        e->byte_mask |= mask;
+        b->stat_stores++;
+        b->stat_coalesced++;
+        return 1;
+    }
+    if (b->count == b->num_entries) {
+        b->stat_full_stalls++;
+        return 0;
+    }
+    e = &b->entry[(b->head + b->count++) % b->num_entries];
+    e->block_addr = block_addr;
+    e->byte_mask = mask;
+    b->stat_stores++;
+    return 1;
+}
+
+// Whether a load of bytes at addr finds all of them buffered
+int storebuf_forward(storebuf_t *b, uint64_t addr, int bytes)
+{
+    storebuf_entry_t *e = storebuf_find(b, addr & ~((uint64_t) b->block_size - 1));
+    uint64_t mask = storebuf_mask(b, addr, bytes);
+    if (!e || (e->byte_mask & mask) != mask) return 0;
+    b->stat_forwarded++;
+    return 1;
+}
+
+// One cycle of draining: the head entry's write into c takes as long as
+// cache_write_latency() says, then the entry is free
+void storebuf_tick(storebuf_t *b, cache_t *c)
+{
+    if (b->num_entries == 0) return;
+    b->stat_cycles++;
+    b->stat_occupancy_sum += b->count;
+    if (b->count > b->stat_peak) b->stat_peak = b->count;
+    if (b->count == 0) return;
+
+    storebuf_entry_t *e = &b->entry[b->head];
+    if (b->drain_cycles < 0) {
+        b->drain_cycles = cache_write_latency(c, e->block_addr);
+    }
+    if (b->drain_cycles > 0 && --b->drain_cycles > 0) return;
+
+    cache_write(c, e->block_addr, __builtin_popcountll(e->byte_mask));
+    b->stat_drained++;
+    b->head = (b->head + 1) % b->num_entries;
+    b->count--;
+    b->drain_cycles = -1;
+}
+
+void storebuf_print_stats(FILE *out, const char *name, const storebuf_t *b)
+{
+    if (b->num_entries == 0) return;
+    fprintf(out, "%s store buffer: %d entries\n", name, b->num_entries);
+    fprintf(out, "  stores %" PRIu64 ", coalesced %" PRIu64 " (%.2f%%), writes drained %" PRIu64
+            ", loads forwarded %" PRIu64 "\n",
+            b->stat_stores, b->stat_coalesced,
+            b->stat_stores ? 100.0 * b->stat_coalesced / b->stat_stores : 0.0,
+            b->stat_drained, b->stat_forwarded);
+    fprintf(out, "  average occupancy %.2f, peak %d, full stalls %" PRIu64 " cycles\n",
+            b->stat_cycles ? (double) b->stat_occupancy_sum / b->stat_cycles : 0.0,
+            b->stat_peak, b->stat_full_stalls);
+}
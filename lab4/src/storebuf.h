@@ -0,0 +1,52 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Store buffer between MEM and a data cache. A store leaves MEM into the
+ * buffer instead of writing the cache there, coalescing into the entry of
+ * a block already buffered. The oldest entry drains into the cache in the
+ * background, for as long as that write takes, and MEM stalls only when
+ * every entry is taken. A load whose bytes are all in the buffer is
+ * forwarded from it without looking the cache up.
+ */
+#ifndef _STOREBUF_H_
+#define _STOREBUF_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "cache.h"
+
+/* most entries a store buffer can be configured with */
+#define STOREBUF_MAX 32
+
+typedef struct storebuf_entry {
+    uint64_t block_addr;
+    uint64_t byte_mask;      /* bytes of the block written, bit per byte */
+} storebuf_entry_t;
+
+typedef struct storebuf {
+    int num_entries;         /* 0 = none: stores write the cache from MEM */
+    int block_size;
+    storebuf_entry_t entry[STOREBUF_MAX]; /* FIFO of count entries from head */
+    int head, count;
+    int drain_cycles;        /* left on the head entry's write, -1 = not started */
+
+    /* statistics */
+    uint64_t stat_stores;
+    uint64_t stat_coalesced;       /* stores merged into a buffered block */
+    uint64_t stat_forwarded;       /* loads served from the buffer */
+    uint64_t stat_drained;         /* writes sent on to the cache */
+    uint64_t stat_full_stalls;     /* cycles MEM waited for an entry */
+    uint64_t stat_cycles;
+    uint64_t stat_occupancy_sum;   /* entries in use summed over cycles */
+    int stat_peak;
+} storebuf_t;
+
+void storebuf_init(storebuf_t *b, int num_entries, int block_size);
+int storebuf_put(storebuf_t *b, uint64_t addr, int bytes);
+int storebuf_forward(storebuf_t *b, uint64_t addr, int bytes);
+void storebuf_tick(storebuf_t *b, cache_t *c);
+void storebuf_print_stats(FILE *out, const char *name, const storebuf_t *b);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ */
+
+#include "tlb.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* virtual addresses are 48 bits, translated 9 bits per level above the page offset */
+#define TLB_VA_BITS   48
+#define TLB_LEVEL_BITS 9
+
+tlb_t *tlb_new(const char *name, int entries, int ways, int page_size)
+{
+    if (ways < 1 || entries < ways || entries % ways != 0) {
+        fprintf(stderr, "Unsupported %s geometry: %d entries, %d ways\n", name, entries, ways);
+        exit(1);
+    }
+    if (page_size < 4096 || (page_size & (page_size - 1)) != 0) {
+        fprintf(stderr, "Unsupported %s page size: %d (power of two >= 4096)\n", name, page_size);
+        exit(1);
+    }
+
+    tlb_t *t = (tlb_t *) calloc(1, sizeof(tlb_t));
+    if (!t) {
+        fprintf(stderr, "Failed to allocate memory for %s\n", name);
+        exit(1);
+    }
+    t->name = name;
+    t->entries = cache_new(entries / ways, ways, page_size);
+    t->entries->name = name;
+    t->page_bits = t->entries->block_offset_bits;
+
+    // Each 9 bits of page offset beyond 4 KB removes one level of the walk
+    t->walk_levels = (TLB_VA_BITS - t->page_bits + TLB_LEVEL_BITS - 1) / TLB_LEVEL_BITS;
+    if (t->walk_levels < 1) t->walk_levels = 1;
+    return t;
+}
+
+void tlb_destroy(tlb_t *t)
+{
+    if (!t) return;
+    cache_destroy(t->entries);
+    free(t);
+}
+
+// Copy contents and statistics between two TLBs of the same geometry
+void tlb_copy(tlb_t *dst, const tlb_t *src)
+{
+    if (!dst || !src) return;
+    cache_copy(dst->entries, src->entries);
+    dst->stat_accesses = src->stat_accesses;
+    dst->stat_misses = src->stat_misses;
+    dst->stat_walk_cycles = src->stat_walk_cycles;
+}
+
+tlb_t *tlb_clone(const tlb_t *src)
+{
+    if (!src) return NULL;
+    tlb_t *t = tlb_new(src->name, src->entries->num_sets * src->entries->num_ways,
+                       src->entries->num_ways, src->entries->block_size);
+    t->walk_level_cycles = src->walk_level_cycles;
+    t->walk_cache = src->walk_cache;
+    tlb_copy(t, src);
+    return t;
+}
+
+// Cycles to read one page-table entry through the walker's cache
+static int tlb_walk_read(tlb_t *t, uint64_t pte_addr)
+{
+    if (cache_check(t->walk_cache, pte_addr)) {
+        return 1;
+    }
+    int latency = cache_miss_latency(t->walk_cache, pte_addr);
+    cache_insert(t->walk_cache, pte_addr);
+    return latency;
+}
+
+// Look vaddr up and return the extra cycles translation costs: 0 on a hit,
+// the page walk on a miss (after which the translation is cached)
+int tlb_translate(tlb_t *t, uint64_t vaddr)
+{
+    if (!t) return 0;
+
+    t->stat_accesses++;
+    if (cache_update(t->entries, vaddr)) {
+        return 0;
+    }
+    t->stat_misses++;
+
+    int cycles = 0;
+    for (int level = 0; level < t->walk_levels; level++) {
+        if (!t->walk_cache) {
+            cycles += t->walk_level_cycles;
+            continue;
+        }
+        // Entry for this level: the virtual page number bits resolved so far,
+        // in the page tables of vaddr's address space
+        int shift = t->page_bits + TLB_LEVEL_BITS * (t->walk_levels - 1 - level);
+        uint64_t space = vaddr >> CACHE_SPACE_SHIFT << CACHE_SPACE_SHIFT;
+        uint64_t pte_addr = space + TLB_PTE_BASE + ((uint64_t) level << 36) +
+                            ((vaddr - space) >> shift) * 8;
+        cycles += tlb_walk_read(t, pte_addr);
+    }
+    t->stat_walk_cycles += cycles;
+    return cycles;
+}
+
+// Forget every translation; returns how many there were
+int tlb_flush(tlb_t *t)
+{
+    if (!t) return 0;
+    return cache_flush(t->entries);
+}
+
+void tlb_print_stats(FILE *out, const tlb_t *t, uint64_t instructions)
+{
+    if (!t) return;
+    fprintf(out, "%s: %d entries, %d-way, %d KB pages, %d-level walk%s\n",
+            t->name, t->entries->num_sets * t->entries->num_ways, t->entries->num_ways,
+            t->entries->block_size / 1024, t->walk_levels,
+            t->walk_cache ? " through the data cache" : "");
+    fprintf(out, "  accesses %" PRIu64 ", misses %" PRIu64 ", MPKI %.2f, average walk %.1f cycles\n",
+            t->stat_accesses, t->stat_misses,
+            instructions ? 1000.0 * t->stat_misses / instructions : 0.0,
+            t->stat_misses ? (double) t->stat_walk_cycles / t->stat_misses : 0.0);
+}
@@ -0,0 +1,45 @@
+/*
+ * CMSC 22200
+ *
+ * ARM pipeline timing simulator
+ *
+ * Translation lookaside buffers. A TLB is a set-associative cache of page
+ * numbers (a cache_t whose block size is the page size); addresses stay
+ * identity-mapped and only the timing of translation is modelled. A miss
+ * pays for a radix page walk, one level per 9 bits of virtual page number,
+ * either at a fixed cost per level or by reading each page-table entry
+ * through a cache.
+ */
+#ifndef _TLB_H_
+#define _TLB_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "cache.h"
+
+/* page-table entries are read from this (otherwise unused) region */
+#define TLB_PTE_BASE 0x7f0000000000ULL
+
+typedef struct tlb {
+    const char *name;
+    cache_t *entries;
+    int page_bits;
+    int walk_levels;          /* 4 for 4 KB pages, fewer for huge pages */
+    int walk_level_cycles;    /* per level when walk_cache is NULL */
+    cache_t *walk_cache;      /* cache the walker reads PTEs through */
+
+    /* statistics */
+    uint64_t stat_accesses;
+    uint64_t stat_misses;
+    uint64_t stat_walk_cycles;
+} tlb_t;
+
+tlb_t *tlb_new(const char *name, int entries, int ways, int page_size);
+void tlb_destroy(tlb_t *t);
+void tlb_copy(tlb_t *dst, const tlb_t *src);
+tlb_t *tlb_clone(const tlb_t *src);
+int tlb_translate(tlb_t *t, uint64_t vaddr);
+int tlb_flush(tlb_t *t);
+void tlb_print_stats(FILE *out, const tlb_t *t, uint64_t instructions);
+
+#endif